@@ -37,26 +37,66 @@ SFFS_Volume::_printDbgNum(uint32 num)
 // CFS_FILE_HEAD
 //
 ***********************************************************************/
-//static
-uint32 SFFS_File::m_fileMemStart = 0;
-//static
-uint32 SFFS_File::m_headSize = sizeof(m_name) + sizeof(m_dataOffset) + sizeof(m_dataMaxSize) + sizeof(m_dataWrittenSize);
+uint32
+SFFS_File::headOffset()
+{
+	return m_volume.FileMemStart() + (m_index*m_volume.FileHeadSize());
+}
+
+// Where a file offset is on the FRAM. Compact() may have moved the file since it was
+// opened, if so the new place is read from its header. Writes restart any move under way.
+uint32
+SFFS_File::_dataAddr(uint32 offset, bool bWrite)
+{
+	if (m_generation != m_volume.Generation())
+	{
+		m_generation = m_volume.Generation();
+		m_volume.Stream().Read(headOffset()+offsetof(SFFS_FILE_HEAD, dataOffset), &m_head.dataOffset, sizeof(m_head.dataOffset));
+	}
+	if (bWrite)
+		m_volume.fileWritten(m_index);
+	return m_head.dataOffset+offset;
+}
 
 bool
-SFFS_File::create(const char* name, uint32 dataOffset, uint32 dataSize, uint index)
+SFFS_File::create(const char* name, uint32 dataOffset, uint32 dataSize, uint index, uint16 flags, uint16 param)
 {
 	fClose();
-	InUse(SFFS_Tools::strcpy(m_name, name, sizeof(m_name)));
+	InUse(SFFS_Tools::strcpy(m_head.name, name, sizeof(m_head.name)));
 	if (InUse())
 	{
 		m_index = index;
-		m_dataOffset = dataOffset;
-		m_dataMaxSize = dataSize;
+		m_head.dataOffset = dataOffset;
+		m_head.dataMaxSize = dataSize;
 		m_streamOffset = 0;
-		m_dataWrittenSize = 0;
-	  	DEBUG_OUT(print("Create: ")); DEBUG_OUT(print(m_name)); DEBUG_OUT(print(" size ")); DEBUG_OUT(println(dataSize));
+		m_head.dataWrittenSize = 0;
+		m_head.aux = 0;
+		m_head.flags = flags;
+		m_head.param = param;
+		m_head.crc = 0;
+		m_uncommitted = 0;
+		m_generation = m_volume.Generation();
+#if SFFS_STATS
+		memset(&m_stats, 0, sizeof(m_stats));
+#endif
+	  	DEBUG_OUT(print("Create: ")); DEBUG_OUT(print(m_head.name)); DEBUG_OUT(print(" size ")); DEBUG_OUT(println(dataSize));
 		fSeek(0);
 		commit();
+		if ((flags & SFFS_FILE_LOG) && dataSize >= sizeof(SFFS_LOG_FRAME))
+		{
+			// Whatever was in the FRAM before must not be taken for records
+			SFFS_LOG_FRAME end = { 0, 0 };
+			m_volume.Stream().Write(dataOffset, &end, sizeof(end));
+		}
+		else if (flags & SFFS_FILE_ATOMIC)
+		{
+			// Slot 0 holds the empty file, slot 1 nothing
+			SFFS_ATOMIC_SLOT slot[2];
+			memset(slot, 0, sizeof(slot));
+			slot[0].check = _slotCheck(&slot[0]);
+			m_volume.Stream().Write(dataOffset, &slot[0], sizeof(slot[0]));
+			m_volume.Stream().Write(dataOffset+_slotSize(), &slot[1], sizeof(slot[1]));
+		}
 	}
 	else
 	{
@@ -65,9 +105,13 @@ SFFS_File::create(const char* name, uint32 dataOffset, uint32 dataSize, uint ind
 	return InUse();
 }
 bool
-SFFS_File::fCreate(const char* fileName, uint32 maxSize)
+SFFS_File::fCreate(const char* fileName, uint32 maxSize, uint16 flags, uint16 param)
 {
-	return m_volume.fileCreate(this, fileName, maxSize);
+	SFFS_TIME(SFFS_OP_CREATE);
+	// Atomic files hold two copies, each with its slot head
+	if (flags & SFFS_FILE_ATOMIC)
+		maxSize = 2*(sizeof(SFFS_ATOMIC_SLOT)+maxSize);
+	return m_volume.fileCreate(this, fileName, maxSize, flags, param);
 }
 
 
@@ -79,60 +123,528 @@ SFFS_File::fOpen(uint index)
 	DEBUG_OUT(print("SFFS: fOpen = ")); DEBUG_OUT(println(index));
 	InUse(true);
 	m_index = index;
-	stream.Seek(headOffset());
-	stream.Read((uint8*)m_name, sizeof(m_name));
-	stream.Read((uint8*)&m_dataOffset, sizeof(m_dataOffset));
-	stream.Read((uint8*)&m_dataMaxSize, sizeof(m_dataMaxSize));
-	stream.Read((uint8*)&m_dataWrittenSize, sizeof(m_dataWrittenSize));
-	m_streamOffset = m_dataWrittenSize;
+	// Shorter headers from older volumes leave the file a plain one
+	memset(&m_head, 0, sizeof(m_head));
+	stream.Read(headOffset(), &m_head, m_volume.FileHeadSize());
+	m_uncommitted = 0;
+	m_generation = m_volume.Generation();
+#if SFFS_STATS
+	memset(&m_stats, 0, sizeof(m_stats));
+#endif
+	// A deleted file's header is only there to hold its space
+	if (m_head.flags & SFFS_FILE_FREE)
+		InUse(false);
+	else if (m_head.flags & SFFS_FILE_LOG)
+		_logRecover();
+	else if (m_head.flags & SFFS_FILE_ATOMIC)
+		_atomicLoad();
+	m_streamOffset = m_head.dataWrittenSize;
 	return InUse();
 }
 bool 
 SFFS_File::fOpen(const char* fileName)
 {
+	SFFS_TIME(SFFS_OP_OPEN);
 	fClose();
 	return m_volume.fileOpen(this, fileName);
 }
 
+bool
+SFFS_File::fDelete()
+{
+	SFFS_TIME(SFFS_OP_DELETE);
+	return m_volume.fileDelete(this);
+}
+bool
+SFFS_File::fDelete(const char* fileName)
+{
+	return fOpen(fileName) && fDelete();
+}
+
 
 void
 SFFS_File::commit()
 {
 	SFFS_Stream& stream = m_volume.Stream();
-	stream.Seek(headOffset());
-	stream.Write((uint8*)m_name, sizeof(m_name));
-	stream.Write((uint8*)&m_dataOffset, sizeof(m_dataOffset));
-	stream.Write((uint8*)&m_dataMaxSize, sizeof(m_dataMaxSize));
-	stream.Write((uint8*)&m_dataWrittenSize, sizeof(m_dataWrittenSize));
+	stream.BeginWrite();
+	stream.Write(headOffset(), &m_head, m_volume.FileHeadSize());
+	stream.EndWrite();
 }
 void
 SFFS_File::commitWrite()
 {
 	SFFS_Stream& stream = m_volume.Stream();
-	stream.Seek(headOffset());
-	stream.Skip(sizeof(m_name));
-	stream.Skip(sizeof(m_dataOffset));
-	stream.Skip(sizeof(m_dataMaxSize));
-	stream.Write((uint8*)&m_dataWrittenSize, sizeof(m_dataWrittenSize));
+	// The aux word goes with the size, where the header has one, and the CRC with both
+	uint32 len = (m_volume.FileHeadSize() > offsetof(SFFS_FILE_HEAD, aux)) ? sizeof(m_head.dataWrittenSize)+sizeof(m_head.aux) : sizeof(m_head.dataWrittenSize);
+	if (m_head.flags & SFFS_FILE_CRC)
+		len = sizeof(m_head)-offsetof(SFFS_FILE_HEAD, dataWrittenSize);
+	stream.BeginWrite();
+	stream.Write(headOffset()+offsetof(SFFS_FILE_HEAD, dataWrittenSize), &m_head.dataWrittenSize, len);
+	stream.EndWrite();
+	m_uncommitted = 0;
+}
+
+void
+SFFS_File::fSync()
+{
+	SFFS_TIME(SFFS_OP_SYNC);
+	// Queued writes may add to the size
+	m_volume.AsyncWait();
+	if (InUse() && m_uncommitted > 0)
+		commitWrite();
+	m_volume.VolumeSync();
+}
+
+uint16
+SFFS_File::fAppend(const void* pRecord, uint16 len)
+{
+	SFFS_TIME(SFFS_OP_APPEND);
+	SFFS_Stream& stream = m_volume.Stream();
+	SFFS_LOG_FRAME frame = { len, (uint16)m_head.aux };
+	SFFS_LOG_FRAME end = { 0, 0 };
+	uint32 offset = m_head.dataWrittenSize;
+	uint32 next = offset+sizeof(frame)+len;
+
+	if (m_head.flags & SFFS_FILE_RING)
+		return _ringAppend(pRecord, len);
+	if (!(m_head.flags & SFFS_FILE_LOG) || len==0 || next > m_head.dataMaxSize)
+		return 0;
+	uint32 addr = _dataAddr(offset, true);
+	// The record goes out with its framing and a new end marker, in one transfer
+	sIO_VEC vec[3] = {
+		{ addr, &frame, sizeof(frame) },
+		{ addr+(uint32)sizeof(frame), (void*)pRecord, len },
+		{ addr+(uint32)sizeof(frame)+len, &end, sizeof(end) }
+	};
+	m_aheadCount = 0;
+	stream.BeginWrite();
+	stream.WriteV(vec, (next+sizeof(end) <= m_head.dataMaxSize) ? 3 : 2);
+	m_head.aux++;
+	seek(offset);
+	_hasWritten(next-offset);
+	stream.EndWrite();
+	_countIO(true, len);
+	return len;
+}
+
+uint16
+SFFS_File::fReadNext(void* pBuf, uint16 size)
+{
+	SFFS_LOG_FRAME frame;
+	uint32 start = fTell();
+
+	if (fRead(&frame, sizeof(frame)) != sizeof(frame) || frame.len==0 || start+sizeof(frame)+frame.len > fSize())
+	{
+		seek(start);
+		return 0;
+	}
+	fRead(pBuf, (frame.len < size) ? frame.len : size);
+	seek(start+sizeof(frame)+frame.len);
+	return frame.len;
+}
+
+// The ring's next write position is kept in aux, and the unread data in dataWrittenSize,
+// so one header write covers both
+uint16
+SFFS_File::_ringAppend(const void* pRecord, uint16 len)
+{
+	SFFS_Stream& stream = m_volume.Stream();
+
+	if (len != m_head.param)
+		return 0;
+	stream.BeginWrite();
+	stream.Write(_dataAddr(m_head.aux, true), (void*)pRecord, len);
+	m_head.aux = (m_head.aux+len) % _ringSize();
+	if (m_head.dataWrittenSize < _ringSize())
+		m_head.dataWrittenSize += len;
+	commitWrite();
+	stream.EndWrite();
+	return len;
+}
+
+// Read from an offset counted from the oldest record, in at most two pieces
+uint32
+SFFS_File::_ringRead(uint32 offset, void* pDest, uint32 count)
+{
+	uint32 ringSize = _ringSize();
+	if (count==0)
+		return 0;
+	uint32 start = (m_head.aux + ringSize - m_head.dataWrittenSize + offset) % ringSize;
+	uint32 first = (count < ringSize-start) ? count : ringSize-start;
+	uint32 addr = _dataAddr(0);
+	sIO_VEC vec[2] = {
+		{ addr+start, pDest, first },
+		{ addr, (uint8*)pDest+first, count-first }
+	};
+	return m_volume.Stream().ReadV(vec, (count > first) ? 2 : 1);
+}
+
+uint16
+SFFS_File::fReadOldest(void* pRecord)
+{
+	SFFS_TIME(SFFS_OP_READ);
+	if (!(m_head.flags & SFFS_FILE_RING) || m_head.dataWrittenSize < m_head.param)
+		return 0;
+	_countIO(false, _ringRead(0, pRecord, m_head.param));
+	m_head.dataWrittenSize -= m_head.param;
+	commitWrite();
+	// The file position stays on the same data
+	seek((m_streamOffset > m_head.param) ? m_streamOffset-m_head.param : 0);
+	return m_head.param;
+}
+
+uint16
+SFFS_File::fReadLatest(void* pRecords, uint16 count)
+{
+	SFFS_TIME(SFFS_OP_READ);
+	if (!(m_head.flags & SFFS_FILE_RING))
+		return 0;
+	uint32 have = m_head.dataWrittenSize/m_head.param;
+	if (count > have)
+		count = have;
+	_countIO(false, _ringRead(m_head.dataWrittenSize-((uint32)count*m_head.param), pRecords, (uint32)count*m_head.param));
+	return count;
+}
+
+uint32
+SFFS_File::fReadRecords(uint32 index, uint32 count, void* pRecords)
+{
+	SFFS_TIME(SFFS_OP_READ);
+	uint32 have = fRecordCount();
+	if (index >= have)
+		return 0;
+	if (count > have-index)
+		count = have-index;
+	uint32 done = m_volume.Stream().Read(_dataAddr(index*m_head.param), pRecords, count*m_head.param);
+	_countIO(false, done);
+	return done/m_head.param;
+}
+
+// Through fWrite(), so the size (and CRC) is committed as for any other write
+bool
+SFFS_File::fWriteRecord(uint32 index, const void* pRecord)
+{
+	if (index > fRecordCount() || index >= fRecordMax())
+		return false;
+	seek(index*m_head.param);
+	return fWrite((void*)pRecord, m_head.param)==m_head.param;
+}
+
+// The check covers the size and sequence number, so a head torn part way through
+// its write does not match
+//static
+uint16
+SFFS_File::_slotCheck(const SFFS_ATOMIC_SLOT* pSlot)
+{
+	return (uint16)~(pSlot->seq ^ (uint16)pSlot->size ^ (uint16)(pSlot->size>>16));
+}
+
+// Both slot heads are read in one call, the newest that checks out is the file
+void
+SFFS_File::_atomicLoad()
+{
+	SFFS_ATOMIC_SLOT slot[2];
+	uint32 addr = _dataAddr(0);
+	sIO_VEC vec[2] = {
+		{ addr, &slot[0], sizeof(slot[0]) },
+		{ addr+_slotSize(), &slot[1], sizeof(slot[1]) }
+	};
+	int active = -1;
+
+	m_volume.Stream().ReadV(vec, 2);
+	for (int i=0; i<2; i++)
+	{
+		if (slot[i].check != _slotCheck(&slot[i]) || (slot[i].seq & 1) != i || slot[i].size > fSizeMax())
+			continue;
+		if (active < 0 || (int16)(slot[i].seq-slot[active].seq) > 0)
+			active = i;
+	}
+	// With neither, the file is empty and the next write goes to slot 0
+	m_head.aux = (active < 0) ? 0xFFFF : slot[active].seq;
+	m_head.dataWrittenSize = (active < 0) ? 0 : slot[active].size;
+}
+
+// The data goes to the other slot, then its head makes it the active one. Each is
+// synced to the FRAM before the next, so a block cache can not reorder them.
+uint32
+SFFS_File::_atomicWrite(const void* pSource, uint32 count)
+{
+	SFFS_Stream& stream = m_volume.Stream();
+	SFFS_ATOMIC_SLOT slot;
+
+	if (m_streamOffset != 0 || count > fSizeMax())
+		return 0;
+	slot.size = count;
+	slot.seq = (uint16)(m_head.aux+1);
+	slot.check = _slotCheck(&slot);
+	uint32 addr = _dataAddr(_slotData(slot.seq), true);
+	stream.BeginWrite();
+	stream.Write(addr, (void*)pSource, count);
+	m_volume.VolumeSync();
+	stream.Write(addr-sizeof(slot), &slot, sizeof(slot));
+	m_volume.VolumeSync();
+	stream.EndWrite();
+	m_head.aux = slot.seq;
+	m_head.dataWrittenSize = count;
+	m_streamOffset = count;
+	_countIO(true, count);
+	return count;
+}
+
+// Find the records appended after the size was last committed, each has to carry
+// the next sequence number, and the end marker (or the end of the file) stops it
+void
+SFFS_File::_logRecover()
+{
+	SFFS_LOG_FRAME frame;
+	uint32 offset = m_head.dataWrittenSize;
+
+	while (offset+sizeof(frame) <= m_head.dataMaxSize)
+	{
+		m_volume.Stream().Read(_dataAddr(offset), &frame, sizeof(frame));
+		if (frame.len==0 || frame.seq != (uint16)m_head.aux || offset+sizeof(frame)+frame.len > m_head.dataMaxSize)
+			break;
+		offset += sizeof(frame)+frame.len;
+		m_head.aux++;
+	}
+	m_uncommitted = offset-m_head.dataWrittenSize;
+	m_head.dataWrittenSize = offset;
+}
+
+// Update the CRC for 'count' bytes about to be written at 'offset' of a file 'size' long.
+// Bytes past the end carry the CRC on, and over the old data the CRC changes by the CRC
+// of the old bytes XOR the new, moved on past the bytes after them.
+void
+SFFS_File::_crcWrite(uint32 size, uint32 offset, const void* pData, uint32 count)
+{
+	const uint8* pNew = (const uint8*)pData;
+	uint8 buf[SFFS_CRC_BUFFER];
+
+	if (!(m_head.flags & SFFS_FILE_CRC))
+		return;
+	uint32 over = (offset+count > size) ? size-offset : count;
+	if (over > 0)
+	{
+		uint32 reg = 0;
+		for (uint32 done=0; done<over; )
+		{
+			uint32 len = (over-done > sizeof(buf)) ? sizeof(buf) : over-done;
+			m_volume.Stream().Read(_dataAddr(offset+done), buf, len);
+			for (uint32 i=0; i<len; i++)
+				buf[i] ^= pNew[done+i];
+			reg = SFFS_CRC::Update(reg, buf, len);
+			done += len;
+		}
+		m_head.crc ^= SFFS_CRC::Shift(reg, size-(offset+over));
+	}
+	m_head.crc = SFFS_CRC::Calc(m_head.crc, &pNew[over], count-over);
+}
+
+bool
+SFFS_File::fVerify()
+{
+	uint8 stackBuf[SFFS_CRC_BUFFER];
+	uint8* buf = stackBuf;
+	uint32 bufSize = sizeof(stackBuf);
+	uint32 crc = 0;
+
+	if (!InUse() || !(m_head.flags & SFFS_FILE_CRC))
+		return false;
+	// A larger read-ahead buffer takes fewer transfers, its window is lost
+	if (m_aheadSize > bufSize)
+	{
+		buf = m_pAhead;
+		bufSize = m_aheadSize;
+		m_aheadCount = 0;
+	}
+	for (uint32 done=0; done<m_head.dataWrittenSize; )
+	{
+		uint32 len = boundRead(done, bufSize);
+		if (m_volume.Stream().Read(_dataAddr(done), buf, len) != len)
+			return false;
+		crc = SFFS_CRC::Calc(crc, buf, len);
+		done += len;
+	}
+	_countIO(false, m_head.dataWrittenSize);
+	return (crc == m_head.crc);
 }
 
 
 uint32
 SFFS_File::fRead(void* pDest, uint32 count)
 {
-  	DEBUG_OUT(print("Read: ")); DEBUG_OUT(print(m_name)); DEBUG_OUT(print(" bytes: ")); DEBUG_OUT(println(count));
+  	DEBUG_OUT(print("Read: ")); DEBUG_OUT(print(m_head.name)); DEBUG_OUT(print(" bytes: ")); DEBUG_OUT(println(count));
 #ifdef DEV_DBG
 	_showFH();
 #endif
-	uint32 done = m_volume.Stream().Read(m_dataOffset+m_streamOffset, pDest, boundRead(m_streamOffset, count));
+	SFFS_TIME(SFFS_OP_READ);
+	uint32 done;
+	count = boundRead(m_streamOffset, count);
+	if (m_head.flags & SFFS_FILE_RING)
+		done = _ringRead(m_streamOffset, pDest, count);
+	else if (count < m_aheadSize)
+		done = _readAhead((uint8*)pDest, count);
+	else
+		done = m_volume.Stream().Read(_fileAddr(m_streamOffset), pDest, count);
 	DEBUG_OUT(print("ReadDone: "));	DEBUG_OUT(println(done));
 	_hasRead(done);
+	_countIO(false, done);
 #ifdef DEV_DBG
 	_showFH();
 #endif
 	return done;
 }
 
+uint32
+SFFS_File::fReadV(const sIO_VEC* pVec, uint count)
+{
+	SFFS_TIME(SFFS_OP_READ);
+	sIO_VEC vec[SFFS_IOV_BATCH];
+	uint32 done = 0;
+
+	if (m_head.flags & SFFS_FILE_RING)
+		return 0;
+	uint32 addr = _fileAddr(0);
+	for (uint i=0; i<count; )
+	{
+		uint n = 0;
+		for (; i<count && n<SFFS_IOV_BATCH; i++)
+		{
+			if (pVec[i].offset >= m_head.dataWrittenSize)
+				continue;
+			vec[n].offset = addr+pVec[i].offset;
+			vec[n].pBuf = pVec[i].pBuf;
+			vec[n].count = boundRead(pVec[i].offset, pVec[i].count);
+			seek(pVec[i].offset+vec[n].count);
+			n++;
+		}
+		done += m_volume.Stream().ReadV(vec, n);
+	}
+	_countIO(false, done);
+	return done;
+}
+
+uint32
+SFFS_File::fWriteV(const sIO_VEC* pVec, uint count)
+{
+	SFFS_TIME(SFFS_OP_WRITE);
+	SFFS_Stream& stream = m_volume.Stream();
+	sIO_VEC vec[SFFS_IOV_BATCH];
+	uint32 oldSize = m_head.dataWrittenSize;
+	uint32 size = oldSize;
+	uint32 done = 0;
+	// A CRC file's old data is read before each range is written, so one range per call,
+	// in case the ranges overlap
+	uint batch = (m_head.flags & SFFS_FILE_CRC) ? 1 : SFFS_IOV_BATCH;
+
+	if (m_head.flags & (SFFS_FILE_RING | SFFS_FILE_ATOMIC))
+		return 0;
+	m_aheadCount = 0;
+	uint32 addr = _dataAddr(0, true);
+	// The data and any file size update go out as one burst
+	stream.BeginWrite();
+	for (uint i=0; i<count; )
+	{
+		uint n = 0;
+		for (; i<count && n<batch; i++)
+		{
+			if (pVec[i].offset > size)
+				continue;
+			vec[n].offset = addr+pVec[i].offset;
+			vec[n].pBuf = pVec[i].pBuf;
+			vec[n].count = boundWrite(pVec[i].offset, pVec[i].count);
+			_crcWrite(size, pVec[i].offset, pVec[i].pBuf, vec[n].count);
+			seek(pVec[i].offset+vec[n].count);
+			if (fTell() > size)
+				size = fTell();
+			n++;
+		}
+		done += stream.WriteV(vec, n);
+	}
+	if (size > m_head.dataWrittenSize)
+	{
+		m_head.dataWrittenSize = size;
+		commitWrite();
+	}
+	_crcCommit(oldSize);
+	stream.EndWrite();
+	_countIO(true, done);
+	return done;
+}
+
+// Runs of changed bytes closer than SFFS_DIFF_GAP go out as one range, the ranges a
+// batch at a time through fWriteV(), all in one write session
+uint32
+SFFS_File::fWriteChanged(const void* pData, void* pShadow, uint32 size)
+{
+	const uint8* pNew = (const uint8*)pData;
+	uint8* pOld = (uint8*)pShadow;
+	SFFS_Stream& stream = m_volume.Stream();
+	sIO_VEC vec[SFFS_IOV_BATCH];
+	uint n = 0;
+	uint32 done = 0;
+
+	if (m_head.dataWrittenSize < size || (m_head.flags & SFFS_FILE_ATOMIC))
+	{
+		done = fWriteAt(0, (void*)pData, size);
+		memcpy(pShadow, pData, size);
+		return done;
+	}
+	stream.BeginWrite();
+	for (uint32 i=0; i<size; )
+	{
+		if (pNew[i] == pOld[i])
+		{
+			i++;
+			continue;
+		}
+		uint32 start = i, end = i+1;
+		for (i++; i<size && i-end <= SFFS_DIFF_GAP; i++)
+		{
+			if (pNew[i] != pOld[i])
+				end = i+1;
+		}
+		memcpy(&pOld[start], &pNew[start], end-start);
+		vec[n].offset = start;
+		vec[n].pBuf = &pOld[start];
+		vec[n].count = end-start;
+		i = end;
+		if (++n == SFFS_IOV_BATCH)
+		{
+			done += fWriteV(vec, n);
+			n = 0;
+		}
+	}
+	if (n > 0)
+		done += fWriteV(vec, n);
+	stream.EndWrite();
+	return done;
+}
+
+// Serve a read from the read-ahead window, moving the window on when it runs out
+uint32
+SFFS_File::_readAhead(uint8* pDest, uint32 count)
+{
+	uint32 done = 0;
+	while (done < count)
+	{
+		uint32 offset = m_streamOffset+done;
+		if (offset < m_aheadStart || offset >= m_aheadStart+m_aheadCount)
+		{
+			m_aheadStart = offset;
+			m_aheadCount = m_volume.Stream().Read(_fileAddr(offset), m_pAhead, boundRead(offset, m_aheadSize));
+			if (m_aheadCount==0)
+				break;
+		}
+		uint32 len = m_aheadStart+m_aheadCount-offset;
+		if (len > count-done)
+			len = count-done;
+		memcpy(&pDest[done], &m_pAhead[offset-m_aheadStart], len);
+		done += len;
+	}
+	return done;
+}
+
 #ifdef DEV_DBG
 void
 SFFS_File::_showFH()
@@ -140,26 +652,122 @@ SFFS_File::_showFH()
 	DEBUG_OUT(print(" idx "));
 	DEBUG_OUT(print(m_index));
 	DEBUG_OUT(print(" DOff "));
-	DEBUG_OUT(print(m_dataOffset));
+	DEBUG_OUT(print(m_head.dataOffset));
 	DEBUG_OUT(print(", fp "));
 	DEBUG_OUT(print(m_streamOffset));
 	DEBUG_OUT(print(", size "));
-	DEBUG_OUT(print(m_dataWrittenSize));
+	DEBUG_OUT(print(m_head.dataWrittenSize));
 	DEBUG_OUT(print("/"));
-	DEBUG_OUT(println(m_dataMaxSize));
+	DEBUG_OUT(println(m_head.dataMaxSize));
 }
 #endif
 
 
+bool
+SFFS_File::fReadAsync(SFFS_REQUEST* pReq, uint32 offset, void* pBuf, uint32 count, SFFS_DONE_CB pfnDone, void* pUser)
+{
+	if (!InUse() || (m_head.flags & SFFS_FILE_RING) || pReq->state==SFFS_REQ_QUEUED || pReq->state==SFFS_REQ_ACTIVE)
+		return false;
+	pReq->pFile = this;
+	pReq->pBuf = (uint8*)pBuf;
+	pReq->offset = offset;
+	pReq->count = count;
+	pReq->op = SFFS_REQ_READ;
+	pReq->pfnDone = pfnDone;
+	pReq->pUser = pUser;
+	m_volume.asyncQueue(pReq);
+	return true;
+}
+
+bool
+SFFS_File::fWriteAsync(SFFS_REQUEST* pReq, uint32 offset, const void* pBuf, uint32 count, SFFS_DONE_CB pfnDone, void* pUser)
+{
+	if ((m_head.flags & SFFS_FILE_ATOMIC) || !fReadAsync(pReq, offset, (void*)pBuf, count, pfnDone, pUser))
+		return false;
+	pReq->op = SFFS_REQ_WRITE;
+	return true;
+}
+
+// The request is cut to fit the file when it starts, after anything queued before it
+uint32
+SFFS_File::asyncStep(SFFS_REQUEST* pReq, uint32 maxBytes)
+{
+	SFFS_Stream& stream = m_volume.Stream();
+	bool bWrite = (pReq->op == SFFS_REQ_WRITE);
+
+	if (pReq->state == SFFS_REQ_QUEUED)
+	{
+		if (bWrite)
+			pReq->count = (pReq->offset > m_head.dataWrittenSize) ? 0 : boundWrite(pReq->offset, pReq->count);
+		else
+			pReq->count = (pReq->offset >= m_head.dataWrittenSize) ? 0 : boundRead(pReq->offset, pReq->count);
+		pReq->state = SFFS_REQ_ACTIVE;
+	}
+	if (pReq->done == pReq->count)
+	{
+		pReq->state = SFFS_REQ_DONE;
+		return 0;
+	}
+	uint32 want = pReq->count-pReq->done;
+	if (want > maxBytes)
+		want = maxBytes;
+	uint32 addr = (bWrite) ? _dataAddr(pReq->offset+pReq->done, true) : _fileAddr(pReq->offset+pReq->done);
+	uint32 len;
+	// A short transfer ends the request, with what was done
+	if (bWrite)
+	{
+		uint32 size = m_head.dataWrittenSize;
+		stream.BeginWrite();
+		_crcWrite(size, pReq->offset+pReq->done, &pReq->pBuf[pReq->done], want);
+		len = stream.Write(addr, &pReq->pBuf[pReq->done], want);
+		pReq->done += len;
+		_countIO(true, len);
+		// An fRead() between pieces may have filled the window from the old data
+		m_aheadCount = 0;
+		if (pReq->done == pReq->count || len < want)
+			pReq->state = SFFS_REQ_DONE;
+		// A CRC file's size and CRC are committed together after each piece
+		if (pReq->state == SFFS_REQ_DONE || (m_head.flags & SFFS_FILE_CRC))
+			_grow(pReq->offset+pReq->done);
+		_crcCommit(size);
+		stream.EndWrite();
+	}
+	else
+	{
+		len = stream.Read(addr, &pReq->pBuf[pReq->done], want);
+		pReq->done += len;
+		_countIO(false, len);
+		if (pReq->done == pReq->count || len < want)
+			pReq->state = SFFS_REQ_DONE;
+	}
+	return len;
+}
+
 uint32
 SFFS_File::fWrite(void* pSource, uint32 count)
 {
-  	DEBUG_OUT(print("Write: ")); DEBUG_OUT(print(m_name)); DEBUG_OUT(print(" bytes: ")); DEBUG_OUT(println(count));
+  	DEBUG_OUT(print("Write: ")); DEBUG_OUT(print(m_head.name)); DEBUG_OUT(print(" bytes: ")); DEBUG_OUT(println(count));
 #ifdef DEV_DBG
 	_showFH();
 #endif
-	uint32 done = m_volume.Stream().Write(m_dataOffset+m_streamOffset, pSource, boundWrite(m_streamOffset, count));
+	SFFS_TIME(SFFS_OP_WRITE);
+	SFFS_Stream& stream = m_volume.Stream();
+	// Ring files are only added to by fAppend()
+	if (m_head.flags & SFFS_FILE_RING)
+		return 0;
+	m_aheadCount = 0;
+	if (m_head.flags & SFFS_FILE_ATOMIC)
+		return _atomicWrite(pSource, count);
+	// The data and any file size update go out as one burst
+	uint32 size = m_head.dataWrittenSize;
+	count = boundWrite(m_streamOffset, count);
+	stream.BeginWrite();
+	_crcWrite(size, m_streamOffset, pSource, count);
+	uint32 done = stream.Write(_dataAddr(m_streamOffset, true), pSource, count);
 	_hasWritten(done);
+	_crcCommit(size);
+	stream.EndWrite();
+	_countIO(true, done);
 	DEBUG_OUT(print("WriteDone: ")); DEBUG_OUT(println(done));
 #ifdef DEV_DBG
 	_showFH();
@@ -178,13 +786,31 @@ SFFS_Volume::init()
 {
 	bool bRet = false;
 
-	if (_readBack(4, 0xABADDEED)==0xABADDEED)
+	// Nothing from before a restart is trusted, anything still held back goes out first
+	m_ios.Flush();
+	m_ios.Invalidate();
+	_freeReset();
+	// Requests queued before a restart are dropped
+	for (; m_pAsyncHead; m_pAsyncHead = m_pAsyncHead->pNext)
+		m_pAsyncHead->state = SFFS_REQ_IDLE;
+	m_pAsyncTail = NULL;
+	m_volumeSize = 0;
+	// A volume header that checks out shows the FRAM works, and gives its size,
+	// so the write test and size probe are only needed without one
+	if (_volumeOpen() && m_volumeSize!=0)
 	{
-		m_volumeSize = _volumeSize();
-		if (_volumeOpen()==false)
+		bRet = true;
+	}
+	else if (_readBack(4, 0xABADDEED)==0xABADDEED)
+	{
+		if (VolumeName()==NULL)
 		{
 			DEBUG_OUT(println("SFFS: No volume found."));
 		}
+		m_volumeSize = _volumeSize();
+		// A version 2 or 3 header got here by failing its checksum
+		if (VolumeName()!=NULL && m_head.magic != SFFS_MAGIC_INT_V1)
+			_volumeRepair();
 		bRet = true;
 	}
 	else
@@ -203,14 +829,17 @@ SFFS_Volume::debug(bool bOnOff)
 bool
 SFFS_Volume::VolumeCreate(const char* volumeName)
 {
-	m_magic = SFFS_MAGIC_INT;
-	SFFS_Tools::strcpy(m_volumeName, volumeName, sizeof(m_volumeName));
-	m_fileCount = 0;
-	m_dataMemStart = m_volumeSize;
+	m_head.magic = SFFS_MAGIC_INT;
+	m_head.magic2 = SFFS_MAGIC_INT;
+	SFFS_Tools::strcpy(m_head.volumeName, volumeName, sizeof(m_head.volumeName));
+	m_head.fileCount = 0;
+	m_head.dataMemStart = m_volumeSize;
+	m_head.volumeSize = m_volumeSize;
+	_freeReset();
 	
 	_volumeCommit();
 	
-	DEBUG_OUT(print("Volume '")); DEBUG_OUT(print(m_volumeName)); DEBUG_OUT(println("' created."));
+	DEBUG_OUT(print("Volume '")); DEBUG_OUT(print(m_head.volumeName)); DEBUG_OUT(println("' created."));
 
 	return _volumeOpen();
 }
@@ -220,25 +849,24 @@ SFFS_Volume::_volumeOpen()
 {
 	bool bRet = false;
 
-	m_ios.Seek(0);
-	m_ios.Read((uint8*)&m_magic, sizeof(m_magic));
-	if (m_magic == SFFS_MAGIC_INT)
+	m_ios.Read(0, &m_head, sizeof(m_head));
+	if (((m_head.magic == SFFS_MAGIC_INT || m_head.magic == SFFS_MAGIC_INT_V2) && m_head.magic2 == m_head.magic) ||
+		(m_head.magic == SFFS_MAGIC_INT_V1 && m_head.volumeSize == SFFS_MAGIC_INT_V1))
 	{
-		m_ios.Read(&m_volumeName, sizeof(m_volumeName));
-		m_ios.Read(&m_fileCount, sizeof(m_fileCount));
-		m_ios.Read(&m_dataMemStart, sizeof(m_dataMemStart));
-		m_ios.Read(&m_magic, sizeof(m_magic));
-		if (m_magic == SFFS_MAGIC_INT)
-		{
-			DEBUG_OUT(print("SFFS: Volume '")); 
-			DEBUG_OUT(print(m_volumeName)); 
-			DEBUG_OUT(println("' mounted.")); 
-			SFFS_File::m_fileMemStart = m_ios.Tell();
-			bRet = true;
-		}
+		DEBUG_OUT(print("SFFS: Volume '")); 
+		DEBUG_OUT(print(m_head.volumeName)); 
+		DEBUG_OUT(println("' mounted.")); 
+		// The size is only trusted from an intact header, else it is found again, and a
+		// damaged header's files are not looked at until init() has repaired it
+		if (m_head.magic != SFFS_MAGIC_INT_V1 && m_head.checksum == SFFS_Tools::checksum(&m_head, offsetof(SFFS_VOLUME_HEAD, checksum)))
+			m_volumeSize = m_head.volumeSize;
+		if (m_volumeSize!=0 || m_head.magic == SFFS_MAGIC_INT_V1)
+			_dirBuild();
+		bRet = true;
 	}
 	if (!bRet)
 	{
+		m_head.magic = 0;
 		DEBUG_OUT(println("SFFS: No volume mounted."));
 	}
 	return bRet;
@@ -247,13 +875,32 @@ SFFS_Volume::_volumeOpen()
 void
 SFFS_Volume::_volumeCommit()
 {
-	m_ios.Seek(0);
-	m_ios.Write(&m_magic, sizeof(m_magic));
-	m_ios.Write(&m_volumeName, sizeof(m_volumeName));
-	m_ios.Write(&m_fileCount, sizeof(m_fileCount));
-	m_ios.Write(&m_dataMemStart, sizeof(m_dataMemStart));
-	m_ios.Write(&m_magic, sizeof(m_magic));
-	SFFS_File::m_fileMemStart = m_ios.Tell();
+	m_head.checksum = SFFS_Tools::checksum(&m_head, offsetof(SFFS_VOLUME_HEAD, checksum));
+	m_ios.BeginWrite();
+	m_ios.Write(0, &m_head, _volumeHeadSize());
+	// Volume changes reach the FRAM straight away, with any file header written alongside
+	m_ios.Flush();
+	m_ios.EndWrite();
+}
+
+// A header that failed its checksum, once init() has found the size again. The size is
+// put right and the header sealed with a new checksum, so a later commit can not seal the
+// damaged size. That is only done if its file table and data area fit in the FRAM,
+// otherwise nothing in it is trusted and no volume is mounted.
+void
+SFFS_Volume::_volumeRepair()
+{
+	if (m_head.dataMemStart > m_volumeSize || m_head.fileCount > m_volumeSize/FileHeadSize() ||
+		FileMemStart()+(m_head.fileCount*FileHeadSize()) > m_head.dataMemStart)
+	{
+		DEBUG_OUT(println("SFFS: Volume header damaged, not mounted."));
+		memset(&m_head, 0, sizeof(m_head));
+		return;
+	}
+	DEBUG_OUT(println("SFFS: Volume header repaired."));
+	m_head.volumeSize = m_volumeSize;
+	_volumeCommit();
+	_dirBuild();
 }
 
 uint32
@@ -261,67 +908,486 @@ SFFS_Volume::VolumeFree()
 {
 	if (VolumeName()==NULL)
 		return 0;
-	uint32 memStart = SFFS_File::m_fileMemStart + ((m_fileCount+1)*SFFS_File::m_headSize);
-	return m_dataMemStart-memStart;
+	uint32 memStart = FileMemStart() + ((m_head.fileCount+1)*FileHeadSize());
+	uint32 free = (m_head.dataMemStart > memStart) ? m_head.dataMemStart-memStart : 0;
+	if (_freeLoad())
+	{
+		for (uint i=0; i<m_freeCount; i++)
+			free += m_free[i].size;
+	}
+	return free;
 }
 
 bool
 SFFS_Volume::fileOpen(SFFS_File* pFile, const char* fileName)
 {
-	int index = _findFile(fileName);
-	DEBUG_OUT(print("SFFS: fileOpen = ")); DEBUG_OUT(println(index));
-	if (index == -1)
+	int index = -1;
+
+	// Candidates are confirmed by the name in the header fOpen reads anyway
+	while ((index = _findFile(fileName, index+1, false)) != -1)
+	{
+		DEBUG_OUT(print("SFFS: fileOpen = ")); DEBUG_OUT(println(index));
+		if (pFile->fOpen(index) && SFFS_Tools::strcmp(pFile->fName(), fileName))
+			return true;
+	}
+	pFile->fClose();
+	return false;
+}
+
+// The header is kept, with no name, to hold the file's space as a free extent. A file
+// at the bottom of the data area gives its space straight back.
+bool
+SFFS_Volume::fileDelete(SFFS_File* pFile)
+{
+	SFFS_FILE_HEAD head;
+
+	if (!pFile->InUse() || !_freeLoad())
 		return false;
+	uint index = pFile->index();
+	pFile->fClose();
+	m_moveIndex = -1;
+	_readHead(index, &head);
+	memset(head.name, 0, sizeof(head.name));
+	head.dataWrittenSize = 0;
+	head.aux = 0;
+	head.flags = SFFS_FILE_FREE;
+	head.param = 0;
+	m_ios.BeginWrite();
+	_writeHead(index, &head);
+	_dirAdd(index, "");
+	if (head.dataOffset == m_head.dataMemStart)
+		_freeRelease(index, &head);
+	else
+		_freeAdd(index, head.dataOffset, head.dataMaxSize);
+	m_ios.EndWrite();
+	return true;
+}
+
+void
+SFFS_Volume::asyncQueue(SFFS_REQUEST* pReq)
+{
+	pReq->done = 0;
+	pReq->pNext = NULL;
+	pReq->state = SFFS_REQ_QUEUED;
+	if (m_pAsyncTail)
+		m_pAsyncTail->pNext = pReq;
+	else
+		m_pAsyncHead = pReq;
+	m_pAsyncTail = pReq;
+}
 
-	return pFile->fOpen(index);
+bool
+SFFS_Volume::Poll(uint32 maxBytes)
+{
+	while (m_pAsyncHead && maxBytes > 0)
+	{
+		SFFS_REQUEST* pReq = m_pAsyncHead;
+		// Unfinished means the bytes for this call have run out
+		maxBytes -= pReq->pFile->asyncStep(pReq, maxBytes);
+		if (pReq->state != SFFS_REQ_DONE)
+			break;
+		// Off the queue before the callback, which may queue more
+		m_pAsyncHead = pReq->pNext;
+		if (m_pAsyncHead == NULL)
+			m_pAsyncTail = NULL;
+		if (pReq->pfnDone)
+			pReq->pfnDone(pReq);
+	}
+	return (m_pAsyncHead != NULL);
 }
 
 bool
-SFFS_Volume::fileCreate(SFFS_File* pFile, const char* fileName, uint32 maxSize)
+SFFS_Volume::Compact(uint32 maxBytes)
 {
-	if (_findFile(fileName) == -1)
+	uint8 block[32];
+
+	if (!_freeLoad())
+		return false;
+	if (m_moveIndex < 0)
 	{
-		if (VolumeFree() >= maxSize)
-		{
-			uint32 dataOffset = m_dataMemStart-maxSize;
-			if (pFile->create(fileName, dataOffset, maxSize, m_fileCount))
-			{
-				m_dataMemStart -= maxSize;
-				m_fileCount++;
-				// Save to disk
-				_volumeCommit();
-			}
-			else
-			{
-				// Failed
-			}
-		}
-		else
-		{
-			DEBUG_OUT(println("SFFS: Not enough space!"));
-		}
+		if (!_moveStart())
+			return false;
+		// Giving space back takes a call of its own
+		if (m_moveIndex < 0)
+			return true;
 	}
-	else
+	// Copied upwards into the top of the free extent, which the file does not overlap,
+	// so the file is whole where its header says until the move is finished
+	while (maxBytes > 0 && m_moveDone < m_moveSize)
 	{
-		DEBUG_OUT(println("SFFS: File already exists!"));
+		uint32 len = m_moveSize-m_moveDone;
+		if (len > sizeof(block))
+			len = sizeof(block);
+		if (len > maxBytes)
+			len = maxBytes;
+		m_ios.Read(m_moveFrom+m_moveDone, block, len);
+		m_ios.Write(m_moveTo+m_moveDone, block, len);
+		m_moveDone += len;
+		maxBytes -= len;
 	}
-	return pFile->InUse();
+	if (m_moveDone == m_moveSize)
+		_moveFinish();
+	return true;
 }
 
-//**************************************************
-// Backup, write, read-back then restore, then compare
-//**************************************************
-uint32
-SFFS_Volume::_readBack(uint32 addr, uint32 data)
+// Find the lowest file or free extent. Space below it that nothing holds, or a free extent
+// at the bottom, is given back to the data area. Otherwise the lowest file is set to move
+// to the top of the free extent that fits it best. False if there is nothing to do.
+bool
+SFFS_Volume::_moveStart()
 {
-  uint32 check = !data;
-  uint32 wrapCheck, backup;
-  m_ios.Read(addr, (uint8*)&backup, sizeof(uint32));
-  m_ios.Write(addr, (uint8*)&data, sizeof(uint32));
-  m_ios.Read(addr, (uint8*)&check, sizeof(uint32));
-  m_ios.Read(0, (uint8_t*)&wrapCheck, sizeof(uint32));
-  m_ios.Write(addr, (uint8*)&backup, sizeof(uint32));
-  // Check for warparound, address 0 will work anyway
+	SFFS_FILE_HEAD head;
+	SFFS_FILE_HEAD low;
+	int lowIndex = -1;
+
+	for (uint i=0; i<m_head.fileCount; i++)
+	{
+		_readHead(i, &head);
+		if (_isEmpty(&head))
+			continue;
+		if (lowIndex < 0 || head.dataOffset < low.dataOffset)
+		{
+			low = head;
+			lowIndex = (int)i;
+		}
+	}
+	uint32 lowOffset = (lowIndex < 0) ? m_volumeSize : low.dataOffset;
+	if (lowOffset > m_head.dataMemStart)
+	{
+		m_head.dataMemStart = lowOffset;
+		_volumeCommit();
+		return true;
+	}
+	if (lowIndex < 0)
+		return false;
+	if (low.flags & SFFS_FILE_FREE)
+	{
+		m_ios.BeginWrite();
+		_freeRelease((uint)lowIndex, &low);
+		m_ios.EndWrite();
+		return true;
+	}
+	int hole = _freeFit(low.dataMaxSize);
+	if (hole < 0)
+		return false;
+	m_moveIndex = lowIndex;
+	m_moveHole = (uint8)hole;
+	m_moveFrom = low.dataOffset;
+	m_moveTo = m_free[hole].offset+m_free[hole].size-low.dataMaxSize;
+	m_moveSize = low.dataMaxSize;
+	m_moveDone = 0;
+	return true;
+}
+
+// Point the file at its new place. The free extent is marked first, so if the power
+// goes before it shrinks, _freeRecover() finishes it off.
+void
+SFFS_Volume::_moveFinish()
+{
+	SFFS_FILE_HEAD head;
+	uint index = m_free[m_moveHole].index;
+
+	m_ios.BeginWrite();
+	_readHead(index, &head);
+	head.dataWrittenSize = m_moveIndex+1;
+	_writeHead(index, &head);
+	_readHead((uint)m_moveIndex, &head);
+	head.dataOffset = m_moveTo;
+	_writeHead((uint)m_moveIndex, &head);
+	_freeShrink(m_moveHole, m_moveSize);
+	m_ios.EndWrite();
+	// Open files read their new data offset
+	m_generation++;
+	m_moveIndex = -1;
+}
+
+void
+SFFS_Volume::_readHead(uint index, SFFS_FILE_HEAD* pHead)
+{
+	memset(pHead, 0, sizeof(SFFS_FILE_HEAD));
+	m_ios.Read(FileMemStart()+(index*FileHeadSize()), pHead, FileHeadSize());
+}
+
+void
+SFFS_Volume::_writeHead(uint index, SFFS_FILE_HEAD* pHead)
+{
+	m_ios.Write(FileMemStart()+(index*FileHeadSize()), pHead, FileHeadSize());
+}
+
+void
+SFFS_Volume::_freeReset()
+{
+	m_freeCount = 0;
+	m_bFreeLoaded = false;
+	m_emptySlot = -1;
+	m_moveIndex = -1;
+}
+
+// Only version 3 volumes have the flags to mark deleted files
+bool
+SFFS_Volume::_freeLoad()
+{
+	SFFS_FILE_HEAD head;
+
+	if (VolumeName()==NULL || FileHeadSize() < sizeof(SFFS_FILE_HEAD))
+		return false;
+	if (m_bFreeLoaded)
+		return true;
+	m_freeCount = 0;
+	m_emptySlot = -1;
+	for (uint i=0; i<m_head.fileCount; i++)
+	{
+		_readHead(i, &head);
+		if (!(head.flags & SFFS_FILE_FREE))
+			continue;
+		if (head.dataWrittenSize != 0)
+			_freeRecover(i, &head);
+		if (_isEmpty(&head))
+			_freeAdd(i, 0, 0);
+		else
+			_freeAdd(i, head.dataOffset, head.dataMaxSize);
+	}
+	m_bFreeLoaded = true;
+	return true;
+}
+
+void
+SFFS_Volume::_freeAdd(uint index, uint32 offset, uint32 size)
+{
+	if (size == 0)
+	{
+		if (m_emptySlot < 0 || (int)index < m_emptySlot)
+			m_emptySlot = (int)index;
+		return;
+	}
+	uint slot = m_freeCount;
+	if (m_freeCount == SFFS_FREE_EXTENTS)
+	{
+		// Full, the smallest makes way
+		slot = 0;
+		for (uint i=1; i<m_freeCount; i++)
+		{
+			if (m_free[i].size < m_free[slot].size)
+				slot = i;
+		}
+		if (m_free[slot].size >= size)
+			return;
+	}
+	else
+	{
+		m_freeCount++;
+	}
+	m_free[slot].offset = offset;
+	m_free[slot].size = size;
+	m_free[slot].index = (uint16)index;
+}
+
+void
+SFFS_Volume::_freeRemove(uint hole)
+{
+	m_free[hole] = m_free[--m_freeCount];
+}
+
+int
+SFFS_Volume::_freeFit(uint32 size)
+{
+	int best = -1;
+
+	if (!_freeLoad() || size == 0)
+		return -1;
+	for (uint i=0; i<m_freeCount; i++)
+	{
+		if (m_free[i].size >= size && (best < 0 || m_free[i].size < m_free[best].size))
+			best = (int)i;
+	}
+	return best;
+}
+
+// The top of the extent has gone to a file, the header's mark is cleared with it
+void
+SFFS_Volume::_freeShrink(uint hole, uint32 size)
+{
+	SFFS_FILE_HEAD head;
+
+	_readHead(m_free[hole].index, &head);
+	head.dataMaxSize -= size;
+	head.dataWrittenSize = 0;
+	_writeHead(m_free[hole].index, &head);
+	m_free[hole].size -= size;
+	if (m_free[hole].size == 0)
+	{
+		// The header is left holding no space
+		_freeAdd(m_free[hole].index, 0, 0);
+		_freeRemove(hole);
+	}
+}
+
+// A free extent marked with a file (index+1 in dataWrittenSize) was being split when the
+// power went. If that file's header already points at the top of the extent, the
+// extent is shrunk, otherwise the file never got there and the mark just goes.
+void
+SFFS_Volume::_freeRecover(uint index, SFFS_FILE_HEAD* pHead)
+{
+	SFFS_FILE_HEAD file;
+	uint fileIndex = pHead->dataWrittenSize-1;
+
+	if (fileIndex < m_head.fileCount && fileIndex != index)
+	{
+		_readHead(fileIndex, &file);
+		if (!(file.flags & SFFS_FILE_FREE) && file.dataMaxSize <= pHead->dataMaxSize &&
+			file.dataOffset == pHead->dataOffset+pHead->dataMaxSize-file.dataMaxSize)
+			pHead->dataMaxSize -= file.dataMaxSize;
+	}
+	pHead->dataWrittenSize = 0;
+	m_ios.BeginWrite();
+	_writeHead(index, pHead);
+	m_ios.EndWrite();
+}
+
+// A free extent at the bottom of the data area goes back to it. The volume header is
+// written first, so if the power goes the extent is left below the data area, which
+// makes its header empty. Empty headers at the end of the table are dropped.
+void
+SFFS_Volume::_freeRelease(uint index, SFFS_FILE_HEAD* pHead)
+{
+	SFFS_FILE_HEAD head;
+	uint32 count = m_head.fileCount;
+
+	m_head.dataMemStart += pHead->dataMaxSize;
+	_volumeCommit();
+	pHead->dataMaxSize = 0;
+	_writeHead(index, pHead);
+	while (m_head.fileCount > 0)
+	{
+		_readHead(m_head.fileCount-1, &head);
+		if (!_isEmpty(&head))
+			break;
+		m_head.fileCount--;
+	}
+	if (m_head.fileCount != count)
+		_volumeCommit();
+	m_bFreeLoaded = false;
+}
+
+bool
+SFFS_Volume::fileCreate(SFFS_File* pFile, const char* fileName, uint32 maxSize, uint16 flags, uint16 param)
+{
+	if (flags != 0 && _fileHeadSize() < sizeof(SFFS_FILE_HEAD))
+	{
+		DEBUG_OUT(println("SFFS: File types need a version 3 volume!"));
+		pFile->fClose();
+	}
+	else if ((flags & (SFFS_FILE_RING | SFFS_FILE_RECORD)) && (param==0 || param > maxSize))
+	{
+		DEBUG_OUT(println("SFFS: Record size does not fit!"));
+		pFile->fClose();
+	}
+	else if ((flags & SFFS_FILE_LOG) && (flags & SFFS_FILE_RING))
+	{
+		pFile->fClose();
+	}
+	else if ((flags & SFFS_FILE_ATOMIC) && (flags & (SFFS_FILE_LOG | SFFS_FILE_RING)))
+	{
+		pFile->fClose();
+	}
+	else if ((flags & SFFS_FILE_CRC) && (flags & (SFFS_FILE_LOG | SFFS_FILE_RING | SFFS_FILE_ATOMIC)))
+	{
+		pFile->fClose();
+	}
+	else if ((flags & SFFS_FILE_RECORD) && (flags & (SFFS_FILE_LOG | SFFS_FILE_RING | SFFS_FILE_ATOMIC)))
+	{
+		pFile->fClose();
+	}
+	else if (flags & ~SFFS_FILE_TYPES)
+	{
+		// Including SFFS_FILE_FREE, only fDelete() sets that
+		pFile->fClose();
+	}
+	else if (_findFile(fileName) == -1)
+	{
+		// The best fitting free extent, or the bottom of the data area. A header left
+		// by a deleted file is reused before the header table grows.
+		int hole = _freeFit(maxSize);
+		uint slot = m_head.fileCount;
+		if (hole >= 0 && m_free[hole].size == maxSize)
+			slot = m_free[hole].index;
+		else if (m_emptySlot >= 0)
+			slot = (uint)m_emptySlot;
+		uint32 need = ((hole >= 0) ? 0 : maxSize) + ((slot == m_head.fileCount) ? FileHeadSize() : 0);
+		if (m_head.dataMemStart >= FileMemStart()+(m_head.fileCount*FileHeadSize()) && _freeLow() >= need)
+		{
+			uint32 dataOffset = (hole >= 0) ? m_free[hole].offset+m_free[hole].size-maxSize : m_head.dataMemStart-maxSize;
+			bool bMark = (hole >= 0 && slot != m_free[hole].index);
+			m_moveIndex = -1;
+			// The file header and volume header go out as one burst
+			m_ios.BeginWrite();
+			if (hole < 0)
+			{
+				// The space is taken first, so a reused header never points below the data area
+				m_head.dataMemStart -= maxSize;
+				if (slot != m_head.fileCount)
+					_volumeCommit();
+			}
+			else if (bMark)
+			{
+				// Marked as being split until it shrinks, see _freeRecover()
+				SFFS_FILE_HEAD head;
+				_readHead(m_free[hole].index, &head);
+				head.dataWrittenSize = slot+1;
+				_writeHead(m_free[hole].index, &head);
+			}
+			if (pFile->create(fileName, dataOffset, maxSize, slot, flags, param))
+			{
+				_dirAdd(slot, fileName);
+				if (slot == m_head.fileCount)
+				{
+					m_head.fileCount++;
+					// Save to disk
+					_volumeCommit();
+				}
+				if (bMark)
+					_freeShrink(hole, maxSize);
+				else if (hole >= 0)
+					_freeRemove(hole);
+				// Another empty header is looked for when next needed
+				if ((int)slot == m_emptySlot)
+					m_bFreeLoaded = false;
+			}
+			else if (hole < 0)
+			{
+				m_head.dataMemStart += maxSize;
+				_volumeCommit();
+			}
+			m_ios.EndWrite();
+		}
+		else
+		{
+			DEBUG_OUT(println("SFFS: Not enough space!"));
+		}
+	}
+	else
+	{
+		DEBUG_OUT(println("SFFS: File already exists!"));
+	}
+	return pFile->InUse();
+}
+
+//**************************************************
+// Backup, write, read-back then restore, then compare
+// Straight to the driver, as a cache would answer it from RAM
+//**************************************************
+uint32
+SFFS_Volume::_readBack(uint32 addr, uint32 data)
+{
+  SFFS_Stream ios(m_driver);
+  uint32 check = !data;
+  uint32 wrapCheck, backup;
+  ios.Read(addr, (uint8*)&backup, sizeof(uint32));
+  ios.Write(addr, (uint8*)&data, sizeof(uint32));
+  ios.Read(addr, (uint8*)&check, sizeof(uint32));
+  ios.Read(0, (uint8_t*)&wrapCheck, sizeof(uint32));
+  ios.Write(addr, (uint8*)&backup, sizeof(uint32));
+  // Check for warparound, address 0 will work anyway
   if (wrapCheck==check)
     check = 0;
   return check;
@@ -329,30 +1395,483 @@ SFFS_Volume::_readBack(uint32 addr, uint32 data)
 uint32
 SFFS_Volume::_volumeSize()
 {
-	uint32 memSize = 0;
-	// Step through FRAM until we hit a wraparound to get the size
-	while (_readBack(memSize, memSize) == memSize)
-		memSize += 256;
+	// Use the size the device reports, if it can
+	uint32 memSize = m_ios.DeviceSize();
+	if (memSize==0)
+	{
+		// FRAM sizes are powers of two and addresses wrap at the end, so step up the
+		// powers of two until a write wraps around to address 0, or fails
+		memSize = 256;
+		while (memSize < 0x80000000UL && _readBack(memSize, memSize) == memSize)
+			memSize <<= 1;
+	}
 	return memSize;
 }
-// Locate a file by name on the disk, if it exists.
+// Locate a file by name on the disk, if it exists, starting from file index 'first'.
+// Files in the directory index are only read from FRAM when their name hash matches,
+// and with bConfirm false they are returned unread for the caller to check.
 int
-SFFS_Volume::_findFile(const char* fileName)
+SFFS_Volume::_findFile(const char* fileName, uint first, bool bConfirm)
 {
 	char name[SFFS_FILE_NAME_BUFFER_LEN];
-	uint32 offset = SFFS_File::m_fileMemStart;
+	uint32 offset = FileMemStart() + (first*FileHeadSize());
+#if SFFS_DIR_CACHE_SIZE > 0
+	uint16 hash = SFFS_Tools::hash(fileName);
+#else
+	(void)bConfirm;
+#endif
 
-	for (uint i=0; i<m_fileCount; i++)
+	for (uint i=first; i<m_head.fileCount; i++, offset += FileHeadSize())
 	{
-		m_ios.Seek(offset);
-		m_ios.Read(name, sizeof(name));
+#if SFFS_DIR_CACHE_SIZE > 0
+		if (i<SFFS_DIR_CACHE_SIZE)
+		{
+			if (m_dirHash[i] != hash)
+			{
+				SFFS_STAT(dirSkips, 1);
+				continue;
+			}
+			if (!bConfirm)
+			{
+				// The caller reads the header to check it
+				SFFS_STAT(dirSteps, 1);
+				return (int)i;
+			}
+		}
+#endif
+		m_ios.Read(offset, name, sizeof(name));
+		SFFS_STAT(dirSteps, 1);
 		if (SFFS_Tools::strcmp(name, fileName))
 		{
 			// Found it
 			return (int)i;
 		}
-		offset += SFFS_File::m_headSize;
 	}
 	return -1;
 }
 
+// Hash the names of the files on a newly mounted volume into the directory index
+void
+SFFS_Volume::_dirBuild()
+{
+#if SFFS_DIR_CACHE_SIZE > 0
+	// Headers are FileHeadSize() apart, which is shorter than SFFS_FILE_HEAD on older volumes
+	uint8 heads[4*sizeof(SFFS_FILE_HEAD)];
+	uint count = (m_head.fileCount < SFFS_DIR_CACHE_SIZE) ? m_head.fileCount : SFFS_DIR_CACHE_SIZE;
+
+	for (uint i=0; i<count; )
+	{
+		uint block = (count-i < 4) ? count-i : 4;
+		m_ios.Read(FileMemStart() + (i*FileHeadSize()), heads, block*FileHeadSize());
+		for (uint j=0; j<block; j++, i++)
+			m_dirHash[i] = SFFS_Tools::hash((const char*)&heads[j*FileHeadSize()]);
+	}
+#endif
+}
+
+void
+SFFS_Volume::_dirAdd(uint index, const char* fileName)
+{
+#if SFFS_DIR_CACHE_SIZE > 0
+	if (index<SFFS_DIR_CACHE_SIZE)
+		m_dirHash[index] = SFFS_Tools::hash(fileName);
+#else
+	(void)index;
+	(void)fileName;
+#endif
+}
+
+
+/**********************************************************************
+//
+// Statistics
+//
+***********************************************************************/
+#if SFFS_STATS
+// Bucket n holds the times that need n bits, so everything under 2^n us and at least half that
+void
+SFFS_Volume::statsTime(uint8 op, uint32 us)
+{
+	uint bucket = 0;
+	while (us && bucket < SFFS_STATS_BUCKETS-1)
+	{
+		us >>= 1;
+		bucket++;
+	}
+	if (m_stats.latency[op][bucket] < 0xFFFF)
+		m_stats.latency[op][bucket]++;
+}
+
+SFFS_OpTimer::~SFFS_OpTimer()
+{
+	m_volume.statsTime(m_op, (uint32)(micros()-m_start));
+}
+#endif
+
+
+/**********************************************************************
+//
+// SFFS_BlockCache
+//
+***********************************************************************/
+#if SFFS_CACHE_LINES > 0
+#define SFFS_CACHE_NO_LINE 0xFFFFFFFFUL
+
+SFFS_BlockCache::SFFS_BlockCache(cIO_DRV& driver) :
+		cIO_DRV(),
+		m_driver(driver),
+		m_clock(0),
+		m_bDriverSession(false)
+{
+	ResetStats();
+	Invalidate();
+}
+
+void
+SFFS_BlockCache::ResetStats()
+{
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
+void
+SFFS_BlockCache::Invalidate()
+{
+	for (uint i=0; i<SFFS_CACHE_LINES; i++)
+	{
+		m_lines[i].addr = SFFS_CACHE_NO_LINE;
+		m_lines[i].dirtyStart = m_lines[i].dirtyEnd = 0;
+	}
+}
+
+void
+SFFS_BlockCache::Flush()
+{
+	SFFS_CACHE_LINE* pLine = _firstDirty();
+
+	if (pLine==NULL)
+		return;
+	// All the changed lines go out as one burst, in address order
+	m_driver.BeginWrite();
+	for (; pLine!=NULL; pLine = _firstDirty())
+	{
+		// Changes running on into the next line are written with one call
+		SFFS_CACHE_LINE* pNext = _find(pLine->addr+SFFS_CACHE_LINE_SIZE);
+		if (pNext && pLine->dirtyEnd==SFFS_CACHE_LINE_SIZE && pNext->dirtyStart==0 && pNext->dirtyEnd>0)
+		{
+			uint8 data[2*SFFS_CACHE_LINE_SIZE];
+			uint16 len = SFFS_CACHE_LINE_SIZE-pLine->dirtyStart;
+			memcpy(data, &pLine->data[pLine->dirtyStart], len);
+			memcpy(&data[len], pNext->data, pNext->dirtyEnd);
+			_driverWrite(pLine->addr+pLine->dirtyStart, data, len+pNext->dirtyEnd);
+			m_stats.writeBacks += 2;
+			pLine->dirtyStart = pLine->dirtyEnd = 0;
+			pNext->dirtyStart = pNext->dirtyEnd = 0;
+		}
+		else
+		{
+			_writeBack(pLine);
+		}
+	}
+	m_driver.EndWrite();
+}
+
+uint32
+SFFS_BlockCache::Read(uint32 offset, void* pBuf, uint32 count)
+{
+	uint8* pDest = (uint8*)pBuf;
+	uint32 start, end;
+
+	m_stats.bytesRead += count;
+	if (count >= SFFS_CACHE_LINE_SIZE)
+	{
+		// Big reads go straight to the FRAM, with anything newer in the cache laid over them
+		count = m_driver.Read(offset, pDest, count);
+		m_stats.driverRead += count;
+		m_stats.driverCalls++;
+		for (uint i=0; i<SFFS_CACHE_LINES; i++)
+		{
+			_overlap(&m_lines[i], offset, count, &start, &end);
+			if (start<end)
+				memcpy(&pDest[start-offset], &m_lines[i].data[start-m_lines[i].addr], end-start);
+		}
+		return count;
+	}
+#if SFFS_CACHE_LINES > 1
+	// A read across two lines, neither of them cached, fills both with one call
+	uint32 pos = offset % SFFS_CACHE_LINE_SIZE;
+	if (pos+count > SFFS_CACHE_LINE_SIZE && _find(offset-pos)==NULL && _find(offset-pos+SFFS_CACHE_LINE_SIZE)==NULL)
+	{
+		SFFS_CACHE_LINE* pLine = _alloc(offset-pos);
+		pLine->used = ++m_clock;
+		SFFS_CACHE_LINE* pNext = _alloc(offset-pos+SFFS_CACHE_LINE_SIZE);
+		pNext->used = ++m_clock;
+		m_stats.readMisses += 2;
+		_fill(pLine, pNext);
+		memcpy(pDest, &pLine->data[pos], SFFS_CACHE_LINE_SIZE-pos);
+		memcpy(&pDest[SFFS_CACHE_LINE_SIZE-pos], pNext->data, count-(SFFS_CACHE_LINE_SIZE-pos));
+		return count;
+	}
+#endif
+	for (uint32 done=0; done<count; )
+	{
+		uint32 pos = (offset+done) % SFFS_CACHE_LINE_SIZE;
+		uint32 len = (count-done < SFFS_CACHE_LINE_SIZE-pos) ? count-done : SFFS_CACHE_LINE_SIZE-pos;
+		SFFS_CACHE_LINE* pLine = _find(offset+done-pos);
+		if (pLine==NULL)
+		{
+			m_stats.readMisses++;
+			pLine = _alloc(offset+done-pos);
+			_fill(pLine);
+		}
+		else if (!pLine->bFilled && (pos < pLine->dirtyStart || pos+len > pLine->dirtyEnd))
+		{
+			m_stats.readMisses++;
+			_fill(pLine);
+		}
+		else
+		{
+			m_stats.readHits++;
+		}
+		memcpy(&pDest[done], &pLine->data[pos], len);
+		pLine->used = ++m_clock;
+		done += len;
+	}
+	return count;
+}
+
+uint32
+SFFS_BlockCache::Write(uint32 offset, const void* pBuf, uint32 count)
+{
+	const uint8* pSource = (const uint8*)pBuf;
+	uint32 start, end;
+
+	m_stats.bytesWritten += count;
+	if (count >= SFFS_CACHE_LINE_SIZE)
+	{
+		// Big writes go straight to the FRAM, and any cached copy is brought up to date
+		count = _driverWrite(offset, pSource, count);
+		for (uint i=0; i<SFFS_CACHE_LINES; i++)
+		{
+			_overlap(&m_lines[i], offset, count, &start, &end);
+			if (start<end)
+				memcpy(&m_lines[i].data[start-m_lines[i].addr], &pSource[start-offset], end-start);
+		}
+		return count;
+	}
+	for (uint32 done=0; done<count; )
+	{
+		uint16 pos = (offset+done) % SFFS_CACHE_LINE_SIZE;
+		uint16 len = (count-done < (uint32)(SFFS_CACHE_LINE_SIZE-pos)) ? count-done : SFFS_CACHE_LINE_SIZE-pos;
+		SFFS_CACHE_LINE* pLine = _find(offset+done-pos);
+		if (pLine==NULL)
+		{
+			m_stats.writeMisses++;
+			pLine = _alloc(offset+done-pos);
+		}
+		else
+		{
+			m_stats.writeHits++;
+		}
+		// Without the rest of the line read in, its changes have to stay in one run
+		if (!pLine->bFilled && pLine->dirtyStart<pLine->dirtyEnd && (pos > pLine->dirtyEnd || pos+len < pLine->dirtyStart))
+			_fill(pLine);
+		memcpy(&pLine->data[pos], &pSource[done], len);
+		if (pLine->dirtyStart==pLine->dirtyEnd)
+		{
+			pLine->dirtyStart = pos;
+			pLine->dirtyEnd = pos+len;
+		}
+		else
+		{
+			if (pos < pLine->dirtyStart)
+				pLine->dirtyStart = pos;
+			if (pos+len > pLine->dirtyEnd)
+				pLine->dirtyEnd = pos+len;
+		}
+		if (len==SFFS_CACHE_LINE_SIZE)
+			pLine->bFilled = true;
+		pLine->used = ++m_clock;
+		done += len;
+	}
+	return count;
+}
+
+void
+SFFS_BlockCache::_endWriteSession()
+{
+	if (m_bDriverSession)
+	{
+		m_bDriverSession = false;
+		m_driver.EndWrite();
+	}
+}
+
+// Driver sessions are only opened once something is written, so a burst the cache
+// absorbs costs nothing on the bus
+uint32
+SFFS_BlockCache::_driverWrite(uint32 offset, const void* pBuf, uint32 count)
+{
+	if (InWriteSession() && !m_bDriverSession)
+	{
+		m_bDriverSession = true;
+		m_driver.BeginWrite();
+	}
+	count = m_driver.Write(offset, pBuf, count);
+	m_stats.driverWritten += count;
+	m_stats.driverCalls++;
+	return count;
+}
+
+SFFS_CACHE_LINE*
+SFFS_BlockCache::_firstDirty()
+{
+	SFFS_CACHE_LINE* pFirst = NULL;
+	for (uint i=0; i<SFFS_CACHE_LINES; i++)
+	{
+		if (m_lines[i].dirtyStart<m_lines[i].dirtyEnd && (pFirst==NULL || m_lines[i].addr < pFirst->addr))
+			pFirst = &m_lines[i];
+	}
+	return pFirst;
+}
+
+SFFS_CACHE_LINE*
+SFFS_BlockCache::_find(uint32 lineAddr)
+{
+	for (uint i=0; i<SFFS_CACHE_LINES; i++)
+	{
+		if (m_lines[i].addr==lineAddr)
+			return &m_lines[i];
+	}
+	return NULL;
+}
+
+// Reuse an unused line, else the least recently used one
+SFFS_CACHE_LINE*
+SFFS_BlockCache::_alloc(uint32 lineAddr)
+{
+	SFFS_CACHE_LINE* pLine = &m_lines[0];
+	for (uint i=0; i<SFFS_CACHE_LINES; i++)
+	{
+		if (m_lines[i].addr==SFFS_CACHE_NO_LINE)
+		{
+			pLine = &m_lines[i];
+			break;
+		}
+		if (m_lines[i].used < pLine->used)
+			pLine = &m_lines[i];
+	}
+	_writeBack(pLine);
+	pLine->addr = lineAddr;
+	pLine->bFilled = false;
+	pLine->dirtyStart = pLine->dirtyEnd = 0;
+	return pLine;
+}
+
+// Read in the line, and the one after it if given, keeping the changes not yet written
+void
+SFFS_BlockCache::_fill(SFFS_CACHE_LINE* pLine, SFFS_CACHE_LINE* pNext)
+{
+	uint8 data[2*SFFS_CACHE_LINE_SIZE];
+	SFFS_CACHE_LINE* lines[2] = { pLine, pNext };
+
+	m_stats.driverRead += m_driver.Read(pLine->addr, data, (pNext) ? 2*SFFS_CACHE_LINE_SIZE : SFFS_CACHE_LINE_SIZE);
+	m_stats.driverCalls++;
+	for (uint i=0; i<2 && lines[i]!=NULL; i++)
+	{
+		uint8* pData = &data[i*SFFS_CACHE_LINE_SIZE];
+		memcpy(&pData[lines[i]->dirtyStart], &lines[i]->data[lines[i]->dirtyStart], lines[i]->dirtyEnd-lines[i]->dirtyStart);
+		memcpy(lines[i]->data, pData, SFFS_CACHE_LINE_SIZE);
+		lines[i]->bFilled = true;
+	}
+}
+
+void
+SFFS_BlockCache::_writeBack(SFFS_CACHE_LINE* pLine)
+{
+	if (pLine->dirtyStart<pLine->dirtyEnd)
+	{
+		_driverWrite(pLine->addr+pLine->dirtyStart, &pLine->data[pLine->dirtyStart], pLine->dirtyEnd-pLine->dirtyStart);
+		m_stats.writeBacks++;
+	}
+	pLine->dirtyStart = pLine->dirtyEnd = 0;
+}
+
+// The part of [offset, offset+count) the line holds valid data for, empty if none
+void
+SFFS_BlockCache::_overlap(SFFS_CACHE_LINE* pLine, uint32 offset, uint32 count, uint32* pStart, uint32* pEnd)
+{
+	*pStart = *pEnd = 0;
+	if (pLine->addr==SFFS_CACHE_NO_LINE)
+		return;
+	uint32 lineStart = pLine->addr + ((pLine->bFilled) ? 0 : pLine->dirtyStart);
+	uint32 lineEnd = pLine->addr + ((pLine->bFilled) ? SFFS_CACHE_LINE_SIZE : pLine->dirtyEnd);
+	*pStart = (offset > lineStart) ? offset : lineStart;
+	*pEnd = (offset+count < lineEnd) ? offset+count : lineEnd;
+	if (*pStart > *pEnd)
+		*pEnd = *pStart;
+}
+#endif
+
+/**********************************************************************
+//
+// SFFS_VolumeManager
+//
+***********************************************************************/
+bool
+SFFS_VolumeManager::Mount(SFFS_Volume& volume)
+{
+	if (m_count>=SFFS_MAX_VOLUMES || volume.VolumeName()==NULL)
+		return false;
+	for (uint i=0; i<m_count; i++)
+	{
+		if (m_pVolumes[i]==&volume)
+			return true;
+	}
+	m_pVolumes[m_count++] = &volume;
+	return true;
+}
+
+void
+SFFS_VolumeManager::Unmount(SFFS_Volume& volume)
+{
+	for (uint i=0; i<m_count; i++)
+	{
+		if (m_pVolumes[i]==&volume)
+		{
+			volume.VolumeSync();
+			for (m_count--; i<m_count; i++)
+				m_pVolumes[i] = m_pVolumes[i+1];
+			return;
+		}
+	}
+}
+
+SFFS_Volume*
+SFFS_VolumeManager::Find(const char* volumeName)
+{
+	for (uint i=0; i<m_count; i++)
+	{
+		if (m_pVolumes[i]->VolumeName() && SFFS_Tools::strcmp(m_pVolumes[i]->VolumeName(), volumeName))
+			return m_pVolumes[i];
+	}
+	return NULL;
+}
+
+SFFS_Volume*
+SFFS_VolumeManager::FindFile(const char* fileName)
+{
+	for (uint i=0; i<m_count; i++)
+	{
+		if (m_pVolumes[i]->FileExists(fileName))
+			return m_pVolumes[i];
+	}
+	return NULL;
+}
+
+void
+SFFS_VolumeManager::Sync()
+{
+	for (uint i=0; i<m_count; i++)
+		m_pVolumes[i]->VolumeSync();
+}
+
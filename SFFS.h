@@ -39,14 +39,272 @@
 #ifndef _SFFS_H
 #define _SFFS_H
 
+#include <stddef.h>
 #include "io_driver.h"
 
-#define SFFS_MAGIC_INT (uint32)('1'<<24 | '0'<<16 | 'S'<<8 | 'F')
+#define SFFS_MAGIC_INT (uint32)('3'<<24 | '0'<<16 | 'S'<<8 | 'F')
+#define SFFS_MAGIC_INT_V2 (uint32)('2'<<24 | '0'<<16 | 'S'<<8 | 'F') // Volumes with short file headers
+#define SFFS_MAGIC_INT_V1 (uint32)('1'<<24 | '0'<<16 | 'S'<<8 | 'F') // Volumes without a cached size
 #define SFFS_FILE_NAME_LEN 15 // Maximum length of a file or volume name (excluding the trailing 0)
 #define SFFS_FILE_NAME_BUFFER_LEN (SFFS_FILE_NAME_LEN+1)
 
+// Number of files held in the in-RAM directory index (2 bytes each), built at mount
+// so that looking up a file by name needs no FRAM reads. 0 disables it, and files
+// beyond this count are found by reading their headers as usual.
+#ifndef SFFS_DIR_CACHE_SIZE
+#if defined(__AVR__)
+#define SFFS_DIR_CACHE_SIZE 0
+#else
+#define SFFS_DIR_CACHE_SIZE 64
+#endif
+#endif
+
+// Optional write-back block cache under SFFS_Volume::Stream(), SFFS_CACHE_LINES lines of
+// SFFS_CACHE_LINE_SIZE bytes. Small reads and writes are served from RAM, and changes reach
+// the FRAM on VolumeSync(), fSync(), fClose() or when their line is reused. 0 disables it.
+#ifndef SFFS_CACHE_LINES
+#define SFFS_CACHE_LINES 0
+#endif
+#ifndef SFFS_CACHE_LINE_SIZE
+#define SFFS_CACHE_LINE_SIZE 32
+#endif
+
+// Volumes SFFS_VolumeManager can hold at once
+#ifndef SFFS_MAX_VOLUMES
+#define SFFS_MAX_VOLUMES 4
+#endif
+
+// Ranges passed to the driver per call by fReadV() and fWriteV(), on the stack
+#ifndef SFFS_IOV_BATCH
+#define SFFS_IOV_BATCH 8
+#endif
+
+// Free extents left by deleted files, held in RAM for fCreate() to reuse, the largest
+// are kept when there are more
+#ifndef SFFS_FREE_EXTENTS
+#define SFFS_FREE_EXTENTS 8
+#endif
+
+// Bytes of queued file reads and writes Poll() moves per call by default
+#ifndef SFFS_ASYNC_STEP
+#define SFFS_ASYNC_STEP 64
+#endif
+
+// Bytes of file data Compact() moves per call by default
+#ifndef SFFS_COMPACT_STEP
+#define SFFS_COMPACT_STEP 256
+#endif
+
+// fWriteChanged() sends unchanged gaps up to this long, rather than start another write
+#ifndef SFFS_DIFF_GAP
+#define SFFS_DIFF_GAP 8
+#endif
+
+// CRC-32 kernels for SFFS_FILE_CRC files, SFFS_CRC_KERNEL picks one. The table is a 1KB
+// const (flash only on AVR), slice-by-4 and slice-by-8 are faster but build 3KB or 7KB
+// more in RAM when first used, so are only taken when asked for. The hardware one is the
+// ESP32 ROM routine or the ARMv8 CRC32 instructions.
+#define SFFS_CRC_BITWISE 0
+#define SFFS_CRC_TABLE 1
+#define SFFS_CRC_SLICE4 4
+#define SFFS_CRC_SLICE8 8
+#define SFFS_CRC_HW 9
+#ifndef SFFS_CRC_KERNEL
+#if defined(ARDUINO_ARCH_ESP32) || defined(__ARM_FEATURE_CRC32)
+#define SFFS_CRC_KERNEL SFFS_CRC_HW
+#else
+#define SFFS_CRC_KERNEL SFFS_CRC_TABLE
+#endif
+#endif
+
+// Stack bytes fVerify(), and overwrites of SFFS_FILE_CRC files, read the old data through,
+// one FRAM transfer each
+#ifndef SFFS_CRC_BUFFER
+#if defined(__AVR__)
+#define SFFS_CRC_BUFFER 32
+#else
+#define SFFS_CRC_BUFFER 128
+#endif
+#endif
+
+// Longest SFFS_KV key, with its terminator, each slot holds this many bytes of key
+#ifndef SFFS_KV_KEY_LEN
+#define SFFS_KV_KEY_LEN 16
+#endif
+
+// Tags SFFS_KV reads at a time along a probe, when there is no keyIndex()
+#ifndef SFFS_KV_PROBE_TAGS
+#define SFFS_KV_PROBE_TAGS 8
+#endif
+
+// File types and options, given to fCreate()
+#define SFFS_FILE_LOG 0x0001 // Records added with fAppend(), the size is committed every 'param' bytes or on fSync()
+#define SFFS_FILE_RING 0x0002 // Records of 'param' bytes added with fAppend(), the oldest is overwritten when full
+#define SFFS_FILE_ATOMIC 0x0004 // Two slots, an fWrite() from the start replaces the contents whole or not at all
+#define SFFS_FILE_CRC 0x0008 // A CRC-32 of the data is kept up to date with each write, checked by fVerify()
+#define SFFS_FILE_RECORD 0x0010 // An array of 'param' byte records, read and written by index
+#define SFFS_FILE_TYPES (SFFS_FILE_LOG | SFFS_FILE_RING | SFFS_FILE_ATOMIC | SFFS_FILE_CRC | SFFS_FILE_RECORD)
+// Set by fDelete(), the header keeps the file's data space as a free extent
+#define SFFS_FILE_FREE 0x8000
+
+// On media file header, read and written with a single driver call
+typedef struct {
+	char name[SFFS_FILE_NAME_BUFFER_LEN];
+	uint32 dataOffset;
+	uint32 dataMaxSize;
+	uint32 dataWrittenSize;
+	// Version 1 and 2 volumes have file headers that end here
+	uint32 aux;			// Depends on the file type, written along with dataWrittenSize
+	uint16 flags;		// SFFS_FILE_ type and options, 0 for a plain file
+	uint16 param;		// Depends on the file type, set by fCreate()
+	uint32 crc;			// CRC-32 of the data of SFFS_FILE_CRC files, written along with dataWrittenSize
+}SFFS_FILE_HEAD;
+
+// A free extent and the deleted file header that holds it
+typedef struct {
+	uint32 offset;
+	uint32 size;
+	uint16 index;
+}SFFS_FREE_EXTENT;
+
+// Framing ahead of each record in a log file, a zero length marks the end
+typedef struct {
+	uint16 len;
+	uint16 seq;
+}SFFS_LOG_FRAME;
+
+// Head of each of an atomic file's two slots, written after the slot's data. The
+// newest slot whose check matches holds the file.
+typedef struct {
+	uint32 size;
+	uint16 seq;			// Even in slot 0, odd in slot 1
+	uint16 check;
+}SFFS_ATOMIC_SLOT;
+
+// Start of an SFFS_KV file, a tag per bucket follows it and then the slots
+#define SFFS_KV_MAGIC 0x324B4653
+typedef struct {
+	uint32 magic;
+	uint16 buckets;
+	uint16 valueSize;		// Bytes of value each slot has room for
+}SFFS_KV_HEAD;
+
+// SFFS_KV slot tags, any other value is a byte of the hash of the key held
+#define SFFS_KV_EMPTY	0
+#define SFFS_KV_ERASED	1
+
+// Head of each SFFS_KV slot, its value follows. The slot's tag is written last for a new
+// key, so a slot is not used until the rest of it is in place.
+typedef struct {
+	uint16 len;
+	char key[SFFS_KV_KEY_LEN];
+}SFFS_KV_SLOT;
+
+class SFFS_File;
+
+// Queued request states
+#define SFFS_REQ_IDLE	0
+#define SFFS_REQ_QUEUED	1
+#define SFFS_REQ_ACTIVE	2
+#define SFFS_REQ_DONE	3
+
+#define SFFS_REQ_READ	0
+#define SFFS_REQ_WRITE	1
+
+struct SFFS_REQUEST;
+typedef void (*SFFS_DONE_CB)(struct SFFS_REQUEST* pReq);
+
+// A queued file read or write, owned by the caller, zeroed before first use and left
+// alone until its state is SFFS_REQ_DONE, 'done' is then the bytes moved
+typedef struct SFFS_REQUEST {
+	SFFS_File* pFile;
+	uint8* pBuf;
+	uint32 offset;
+	uint32 count;
+	uint32 done;
+	uint8 op;
+	volatile uint8 state;
+	SFFS_DONE_CB pfnDone;		// Called from Poll() when done, or NULL
+	void* pUser;
+	struct SFFS_REQUEST* pNext;
+}SFFS_REQUEST;
+
+#if SFFS_STATS
+// Operations timed by the latency histograms
+#define SFFS_OP_OPEN	0
+#define SFFS_OP_CREATE	1
+#define SFFS_OP_READ	2
+#define SFFS_OP_WRITE	3
+#define SFFS_OP_APPEND	4
+#define SFFS_OP_SYNC	5
+#define SFFS_OP_DELETE	6
+#define SFFS_OPS		7
+
+// Latency histogram buckets, bucket n counts calls taking under 2^n us, and at least half that
+#ifndef SFFS_STATS_BUCKETS
+#define SFFS_STATS_BUCKETS 16
+#endif
+
+typedef struct {
+	sIO_STATS bus;			// What the drivers put on the bus, filled in by VolumeStats()
+	uint32 headReads;		// Stream calls below the data area, for the volume and file headers
+	uint32 headWrites;
+	uint32 headBytes;
+	uint32 dataReads;		// Stream calls for file data
+	uint32 dataWrites;
+	uint32 dataBytes;
+	uint32 dirSteps;		// File headers read looking up names
+	uint32 dirSkips;		// File headers the directory index ruled out unread
+	uint16 latency[SFFS_OPS][SFFS_STATS_BUCKETS];
+}SFFS_VOLUME_STATS;
+
+// Reads and writes through one file handle since it was opened
+typedef struct {
+	uint32 reads;
+	uint32 writes;
+	uint32 bytesRead;
+	uint32 bytesWritten;
+}SFFS_FILE_STATS;
+
+#define SFFS_STAT(field, n) (m_stats.field += (n))
+#define SFFS_TIME(op) SFFS_OpTimer _opTimer(m_volume, op)
+#else
+#define SFFS_STAT(field, n)
+#define SFFS_TIME(op)
+#endif
+
+// On media volume header, at FRAM address 0 and followed by the file headers
+typedef struct {
+	uint32 magic;
+	char volumeName[SFFS_FILE_NAME_BUFFER_LEN];
+	uint32 fileCount;
+	uint32 dataMemStart;
+	uint32 volumeSize; // Version 1 volumes have magic2 here, and end here
+	uint32 checksum;   // Of everything before it
+	uint32 magic2;
+}SFFS_VOLUME_HEAD;
+
 class SFFS_Volume;
 
+// CRC-32 as used by zip and Ethernet. Calc() carries on a CRC from the one of the bytes
+// before (0 to start), Update() and Shift() work on the register with no inversion.
+class SFFS_CRC
+{
+public:
+	static uint32 Calc(uint32 crc, const void* pData, uint32 count)
+	{
+		return ~Update(~crc, pData, count);
+	}
+	static uint32 Update(uint32 reg, const void* pData, uint32 count);
+	// As Update() with 'zeroBytes' zeros, in time that grows with log2(zeroBytes)
+	static uint32 Shift(uint32 reg, uint32 zeroBytes);
+	// The CRC of A then B, from the CRCs of each and the length of B
+	static uint32 Combine(uint32 crcA, uint32 crcB, uint32 lenB)
+	{
+		return Shift(crcA, lenB) ^ crcB;
+	}
+};
+
 class SFFS_Tools
 {
 private:
@@ -66,7 +324,7 @@ public:
 		}
 		return false;
 	}
-	static bool strcmp(char* pDest, const char* pSrc)
+	static bool strcmp(const char* pDest, const char* pSrc)
 	{
 		uint i=0;
 		while (pDest[i]==pSrc[i])
@@ -79,6 +337,28 @@ public:
 		}
 		return false;
 	}
+	// Adler-32
+	static uint32 checksum(const void* pData, uint len)
+	{
+		uint32 a = 1, b = 0;
+		for (uint i=0; i<len; i++)
+		{
+			a = (a + ((const uint8*)pData)[i]) % 65521;
+			b = (b + a) % 65521;
+		}
+		return (b<<16) | a;
+	}
+	// 16bit FNV-1a of a file name
+	static uint16 hash(const char* pName)
+	{
+		uint32 hash = 2166136261UL;
+		for (uint i=0; i<SFFS_FILE_NAME_LEN && pName[i] != '\0'; i++)
+		{
+			hash ^= (uint8)pName[i];
+			hash *= 16777619UL;
+		}
+		return (uint16)(hash ^ (hash>>16));
+	}
 };
 
 
@@ -87,12 +367,27 @@ class SFFS_Stream
 private:
 	cIO_DRV& m_driver;
 	uint32 m_offset;
+#if SFFS_STATS
+	SFFS_VOLUME_STATS* m_pStats;
+	const uint32* m_pDataStart;
+#endif
 public:
 	SFFS_Stream(cIO_DRV& driver) : 
 				m_driver(driver), 
 				m_offset(0)
 	{
+#if SFFS_STATS
+		m_pStats = NULL;
+#endif
 	}
+#if SFFS_STATS
+	// Count calls into *pStats, as header or file data I/O by which side of *pDataStart they fall
+	void CountInto(SFFS_VOLUME_STATS* pStats, const uint32* pDataStart)
+	{
+		m_pStats = pStats;
+		m_pDataStart = pDataStart;
+	}
+#endif
 	void Seek(uint32 offset)
 	{
 		m_offset = offset;
@@ -108,6 +403,7 @@ public:
 	uint Read(void* pDest, uint32 count)
 	{
 		count = m_driver.Read(m_offset, pDest, count);
+		_count(m_offset, count, false);
 		m_offset += count;
 		return count;
 	}
@@ -119,6 +415,7 @@ public:
 	uint Write(void* pSource, uint32 count)
 	{
 		count = m_driver.Write(m_offset, pSource, count);
+		_count(m_offset, count, true);
 		m_offset += count;
 		return count;
 	}
@@ -127,8 +424,185 @@ public:
 		Seek(addr);
 		return Write(pSource, count);
 	}
+	// Scattered ranges at their own addresses, the stream position is left alone
+	uint32 ReadV(const sIO_VEC* pVec, uint count)
+	{
+		uint32 done = m_driver.ReadV(pVec, count);
+		if (count > 0)
+			_count(pVec[0].offset, done, false);
+		return done;
+	}
+	uint32 WriteV(const sIO_VEC* pVec, uint count)
+	{
+		uint32 done = m_driver.WriteV(pVec, count);
+		if (count > 0)
+			_count(pVec[0].offset, done, true);
+		return done;
+	}
+	void BeginWrite()
+	{
+		m_driver.BeginWrite();
+	}
+	void EndWrite()
+	{
+		m_driver.EndWrite();
+	}
+	uint32 DeviceSize()
+	{
+		return m_driver.DeviceSize();
+	}
+	// Nothing is held back by a plain stream, a cached one overrides these
+	virtual void Flush()
+	{
+	}
+	virtual void Invalidate()
+	{
+	}
+private:
+	void _count(uint32 addr, uint32 count, bool bWrite)
+	{
+#if SFFS_STATS
+		if (m_pStats==NULL)
+			return;
+		if (addr < *m_pDataStart)
+		{
+			(bWrite) ? m_pStats->headWrites++ : m_pStats->headReads++;
+			m_pStats->headBytes += count;
+		}
+		else
+		{
+			(bWrite) ? m_pStats->dataWrites++ : m_pStats->dataReads++;
+			m_pStats->dataBytes += count;
+		}
+#else
+		(void)addr;
+		(void)count;
+		(void)bWrite;
+#endif
+	}
 };
 
+#if SFFS_STATS
+// Times the rest of the scope it is declared in, into the volume's latency histograms
+class SFFS_OpTimer
+{
+private:
+	SFFS_Volume& m_volume;
+	uint8 m_op;
+	unsigned long m_start;
+public:
+	SFFS_OpTimer(SFFS_Volume& volume, uint8 op) :
+			m_volume(volume),
+			m_op(op),
+			m_start(micros())
+	{
+	}
+	~SFFS_OpTimer();
+};
+#endif
+
+
+#if SFFS_CACHE_LINES > 0
+typedef struct {
+	uint32 readHits;		// Line lookups, a read or write touching two lines counts twice
+	uint32 readMisses;
+	uint32 writeHits;
+	uint32 writeMisses;
+	uint32 writeBacks;		// Dirty lines written to the FRAM
+	uint32 bytesRead;		// Asked of the cache
+	uint32 bytesWritten;
+	uint32 driverRead;		// Moved by the driver, bytesRead+bytesWritten less these is the saving
+	uint32 driverWritten;
+	uint32 driverCalls;
+}SFFS_CACHE_STATS;
+
+typedef struct {
+	uint32 addr;			// FRAM address of the line, SFFS_CACHE_NO_LINE when unused
+	uint32 used;			// LRU stamp
+	uint16 dirtyStart;		// Bytes changed since the line was last written, none when equal
+	uint16 dirtyEnd;
+	bool bFilled;			// Read from the FRAM, else only the dirty bytes are valid
+	uint8 data[SFFS_CACHE_LINE_SIZE];
+}SFFS_CACHE_LINE;
+
+// LRU write-back cache, a driver in front of the real one
+class SFFS_BlockCache : public cIO_DRV
+{
+private:
+	cIO_DRV& m_driver;
+	uint32 m_clock;
+	bool m_bDriverSession;
+	SFFS_CACHE_STATS m_stats;
+	SFFS_CACHE_LINE m_lines[SFFS_CACHE_LINES];
+public:
+	SFFS_BlockCache(cIO_DRV& driver);
+
+	virtual uint32 Read(uint32 offset, void* pBuf, uint32 count);
+	virtual uint32 Write(uint32 offset, const void* pBuf, uint32 count);
+	virtual uint32 DeviceSize()
+	{
+		return m_driver.DeviceSize();
+	}
+	void Flush();
+	void Invalidate();
+	SFFS_CACHE_STATS& Stats()
+	{
+		return m_stats;
+	}
+	void ResetStats();
+#if SFFS_STATS
+	virtual void AddBusStats(sIO_STATS* pStats)
+	{
+		m_driver.AddBusStats(pStats);
+	}
+	virtual void ResetBusStats()
+	{
+		m_driver.ResetBusStats();
+	}
+#endif
+protected:
+	virtual void _endWriteSession();
+private:
+	uint32 _driverWrite(uint32 offset, const void* pBuf, uint32 count);
+	SFFS_CACHE_LINE* _find(uint32 lineAddr);
+	SFFS_CACHE_LINE* _firstDirty();
+	SFFS_CACHE_LINE* _alloc(uint32 lineAddr);
+	void _fill(SFFS_CACHE_LINE* pLine, SFFS_CACHE_LINE* pNext=NULL);
+	void _writeBack(SFFS_CACHE_LINE* pLine);
+	void _overlap(SFFS_CACHE_LINE* pLine, uint32 offset, uint32 count, uint32* pStart, uint32* pEnd);
+};
+
+class SFFS_CachedStream : public SFFS_Stream
+{
+private:
+	SFFS_BlockCache m_cache;
+public:
+	SFFS_CachedStream(cIO_DRV& driver) :
+				SFFS_Stream(m_cache),
+				m_cache(driver)
+	{
+	}
+	// Write every changed line to the FRAM
+	virtual void Flush()
+	{
+		m_cache.Flush();
+	}
+	// Forget the cached lines, without writing them
+	virtual void Invalidate()
+	{
+		m_cache.Invalidate();
+	}
+	SFFS_CACHE_STATS& Stats()
+	{
+		return m_cache.Stats();
+	}
+	void ResetStats()
+	{
+		m_cache.ResetStats();
+	}
+};
+#endif
+
 
 class SFFS_File
 {
@@ -137,44 +611,81 @@ private:
 	uint m_index;
 	bool m_bInUse;
 	uint32 m_streamOffset;
-	uint32 m_dataOffset;
-	uint32 m_dataWrittenSize;
-	uint32 m_dataMaxSize;
-	char m_name[SFFS_FILE_NAME_BUFFER_LEN];
+	SFFS_FILE_HEAD m_head;
+	uint8* m_pAhead;			// Read-ahead window, m_aheadCount bytes of the file from m_aheadStart
+	uint16 m_aheadSize;
+	uint16 m_aheadCount;
+	uint32 m_aheadStart;
+	uint32 m_uncommitted;		// Bytes written since the size was last committed
+	uint16 m_generation;		// Volume generation the data offset was read at
+#if SFFS_STATS
+	SFFS_FILE_STATS m_stats;
+#endif
 public:
-	static uint32 m_fileMemStart;
-	static uint32 m_headSize;
-
 	SFFS_File(SFFS_Volume& volume) :
-			m_volume(volume)
+			m_volume(volume),
+			m_pAhead(NULL),
+			m_aheadSize(0),
+			m_aheadCount(0),
+			m_aheadStart(0)
 	{
 		InUse(false);
 	}
 	bool fOpen(uint index);
 	bool fOpen(const char* fileName);
-	bool fCreate(const char* fileName, uint32 maxSize);
+	bool fCreate(const char* fileName, uint32 maxSize, uint16 flags=0, uint16 param=0);
+	// Delete the open file, or a file by name, its space is reused by fCreate() and
+	// gathered up by SFFS_Volume::Compact(). Other handles to it must not be used.
+	bool fDelete();
+	bool fDelete(const char* fileName);
 	
 	bool InUse()
 	{
 		return m_bInUse;
 	}
+#if SFFS_STATS
+	// Reads and writes through this handle since the file was opened or created
+	SFFS_FILE_STATS& fStats()
+	{
+		return m_stats;
+	}
+#endif
 
 	//
 	// File operations
 	//
 	uint32 fSize()
 	{
-		return m_dataWrittenSize;
+		return m_head.dataWrittenSize;
 	}
 	uint32 fSizeMax()
 	{
-		return m_dataMaxSize;
+		if (m_head.flags & SFFS_FILE_ATOMIC)
+			return _slotSize()-sizeof(SFFS_ATOMIC_SLOT);
+		return m_head.dataMaxSize;
 	}
 	const char* fName()
 	{
-		return m_name;
+		return m_head.name;
+	}
+	// SFFS_FILE_CRC files, the CRC of the data as last written, and whether the data
+	// read back from the FRAM still matches it. fVerify() reads one transfer per
+	// SFFS_CRC_BUFFER bytes, or per read-ahead buffer when one is set and larger.
+	uint32 fCrc()
+	{
+		return m_head.crc;
 	}
+	bool fVerify();
 	uint32 fRead(void* pBuf, uint32 count);
+	// Reads smaller than the buffer are served from it, refilled a buffer's worth at a
+	// time, so a file read sequentially in small pieces costs few FRAM reads.
+	// NULL turns read-ahead off, the buffer must outlive its use by this file.
+	void fReadAhead(void* pBuf, uint16 size)
+	{
+		m_pAhead = (uint8*)pBuf;
+		m_aheadSize = (pBuf) ? size : 0;
+		m_aheadCount = 0;
+	}
 	uint32 fReadAt(uint32 offset, void* pBuf, uint32 count)
 	{
 		if (fSeek(offset)==offset)
@@ -182,47 +693,154 @@ public:
 		return 0;
 	}
 	uint32 fWrite(void* pBuf, uint32 count);
+	// Log files, add a record at the end of the file and return its length, or 0 if
+	// it does not fit. fReadNext() reads the record at the file position and moves on
+	// to the next, returning its full length (at most 'size' bytes are copied) or 0.
+	uint16 fAppend(const void* pRecord, uint16 len);
+	uint16 fReadNext(void* pBuf, uint16 size);
+	// Ring files, fSize() is the unread data and offsets count from the oldest record.
+	// fReadOldest() takes the oldest record off the ring, fReadLatest() copies up to
+	// the 'count' newest records, oldest first, and returns how many it copied.
+	uint16 fReadOldest(void* pRecord);
+	uint16 fReadLatest(void* pRecords, uint16 count);
+	// Record files, records are 'param' bytes at index*param. An index must be below
+	// fRecordCount(), except that fWriteRecord() may add the record at the end.
+	// fReadRecords() reads up to 'count' records from 'index' in one transfer and
+	// returns how many it read.
+	uint32 fRecordCount()
+	{
+		return (m_head.flags & SFFS_FILE_RECORD) ? m_head.dataWrittenSize/m_head.param : 0;
+	}
+	uint32 fRecordMax()
+	{
+		return (m_head.flags & SFFS_FILE_RECORD) ? m_head.dataMaxSize/m_head.param : 0;
+	}
+	bool fReadRecord(uint32 index, void* pRecord)
+	{
+		return fReadRecords(index, 1, pRecord)==1;
+	}
+	uint32 fReadRecords(uint32 index, uint32 count, void* pRecords);
+	bool fWriteRecord(uint32 index, const void* pRecord);
+	bool fAppendRecord(const void* pRecord)
+	{
+		return fWriteRecord(fRecordCount(), pRecord);
+	}
+	// Read or write several ranges of the file, each offset is from the start of the file.
+	// Reads stop at fSize(), and a write may start anywhere up to the size the ranges
+	// before it have grown the file to. Returns the total bytes done.
+	uint32 fReadV(const sIO_VEC* pVec, uint count);
+	uint32 fWriteV(const sIO_VEC* pVec, uint count);
 	uint32 fWriteAt(uint32 offset, void* pBuf, uint32 count)
 	{
 		if (fSeek(offset)==offset)
 			return fWrite(pBuf, count);
 		return 0;
 	}
+	// Write the bytes of pData that differ from pShadow, a copy of the file's first 'size'
+	// bytes, in one write session, then bring pShadow up to date. A file shorter than
+	// 'size' is written whole. Returns the bytes written.
+	uint32 fWriteChanged(const void* pData, void* pShadow, uint32 size);
+	// Queue a read or write at a file offset, done a piece at a time by SFFS_Volume::Poll()
+	// in the order queued, so a read sees the writes queued ahead of it. The size of the
+	// file is committed after the last of a write's data. The file position is not used.
+	// fSync() and fClose() finish everything queued first.
+	bool fReadAsync(SFFS_REQUEST* pReq, uint32 offset, void* pBuf, uint32 count, SFFS_DONE_CB pfnDone=NULL, void* pUser=NULL);
+	bool fWriteAsync(SFFS_REQUEST* pReq, uint32 offset, const void* pBuf, uint32 count, SFFS_DONE_CB pfnDone=NULL, void* pUser=NULL);
 	uint32 fSeek(uint32 offset)
 	{
 		if (checkFP(offset))
+		{
+			// The read-ahead window is kept for seeks inside it
+			if (offset < m_aheadStart || offset >= m_aheadStart+m_aheadCount)
+				m_aheadCount = 0;
 			m_streamOffset = offset;
+		}
 		return fTell();
 	}
 	uint32 fTell()
 	{
 		return m_streamOffset;
 	}
+	void fSync();
 	void fClose()
 	{
 		if (InUse())
 		{
+			fSync();
 			InUse(false);
 		}
+		m_aheadCount = 0;
 	}
 
 //protected friend
 public:
-	bool create(const char* name, uint32 dataOffset, uint32 DataSize, uint index);
+	bool create(const char* name, uint32 dataOffset, uint32 DataSize, uint index, uint16 flags, uint16 param);
+	uint index()
+	{
+		return m_index;
+	}
+	uint32 asyncStep(SFFS_REQUEST* pReq, uint32 maxBytes);
 
 private:
 	void InUse(bool bOnOff)
 	{
 		m_bInUse = bOnOff;
 	}
+	void _countIO(bool bWrite, uint32 bytes)
+	{
+		if (bWrite)
+		{
+			SFFS_STAT(writes, 1);
+			SFFS_STAT(bytesWritten, bytes);
+		}
+		else
+		{
+			SFFS_STAT(reads, 1);
+			SFFS_STAT(bytesRead, bytes);
+		}
+		(void)bytes;
+	}
 	void commit();
 	void commitWrite();
+	void _logRecover();
+	uint16 _ringAppend(const void* pRecord, uint16 len);
+	uint32 _ringRead(uint32 offset, void* pDest, uint32 count);
+	// Whole records only, so none of them wrap
+	uint32 _ringSize()
+	{
+		return (m_head.dataMaxSize/m_head.param)*m_head.param;
+	}
+	uint32 _readAhead(uint8* pDest, uint32 count);
+	// Atomic files, each slot is half the file's space, and slot 'seq & 1' holds version 'seq'
+	uint32 _slotSize()
+	{
+		return m_head.dataMaxSize/2;
+	}
+	uint32 _slotData(uint16 seq)
+	{
+		return ((seq & 1) ? _slotSize() : 0)+sizeof(SFFS_ATOMIC_SLOT);
+	}
+	static uint16 _slotCheck(const SFFS_ATOMIC_SLOT* pSlot);
+	void _atomicLoad();
+	uint32 _atomicWrite(const void* pSource, uint32 count);
+	void _crcWrite(uint32 size, uint32 offset, const void* pData, uint32 count);
+	// A write that did not grow the file still has its new CRC to commit
+	void _crcCommit(uint32 oldSize)
+	{
+		if ((m_head.flags & SFFS_FILE_CRC) && m_head.dataWrittenSize == oldSize)
+			commitWrite();
+	}
 
 	void _showFH();
 
-	uint32 headOffset()
+	uint32 headOffset();
+	uint32 _dataAddr(uint32 offset, bool bWrite=false);
+	// Where a file offset is read from, in the active slot of an atomic file
+	uint32 _fileAddr(uint32 offset)
 	{
-		return SFFS_File::m_fileMemStart + (m_index*SFFS_File::m_headSize);
+		if (m_head.flags & SFFS_FILE_ATOMIC)
+			offset += _slotData((uint16)m_head.aux);
+		return _dataAddr(offset);
 	}
 
 	void seek(uint32 offset)
@@ -231,18 +849,18 @@ private:
 	}
 	bool checkFP(uint32 offset)
 	{
-		return (offset<m_dataWrittenSize);
+		return (offset<m_head.dataWrittenSize);
 	}
 	uint32 boundRead(uint32 offset, uint32 count)
 	{
-		if ((offset+count) > m_dataWrittenSize)
-			count = m_dataWrittenSize-offset;
+		if ((offset+count) > m_head.dataWrittenSize)
+			count = m_head.dataWrittenSize-offset;
 		return count;
 	}
 	uint32 boundWrite(uint32 offset, uint32 count)
 	{
-		if ((offset+count) > m_dataMaxSize)
-			count = m_dataMaxSize-offset;
+		if ((offset+count) > m_head.dataMaxSize)
+			count = m_head.dataMaxSize-offset;
 		return count;
 	}
 	void _hasRead(uint32 done)
@@ -252,33 +870,178 @@ private:
 	void _hasWritten(uint32 done)
 	{
 		_hasRead(done);
-		if (m_streamOffset > m_dataWrittenSize)
+		_grow(m_streamOffset);
+	}
+	void _grow(uint32 size)
+	{
+		if (size > m_head.dataWrittenSize)
 		{
-			m_dataWrittenSize = m_streamOffset;
-			commitWrite();
+			m_uncommitted += size-m_head.dataWrittenSize;
+			m_head.dataWrittenSize = size;
+			// Log files hold the new size back until fSync(), or 'param' bytes have built up
+			if (!(m_head.flags & SFFS_FILE_LOG) || (m_head.param && m_uncommitted >= m_head.param))
+				commitWrite();
 		}
 	}
 };
 
 
+// A struct kept in a file, bound to an open file with load(). Change it through
+// '->' or Data(), then sync() writes only the bytes that changed.
+template <class T>
+class SFFS_Persistent
+{
+private:
+	SFFS_File& m_file;
+	T m_data;
+	T m_shadow;					// What the file holds, once load() has run
+	bool m_bLoaded;
+public:
+	SFFS_Persistent(SFFS_File& file) :
+			m_file(file),
+			m_bLoaded(false)
+	{
+		memset(&m_data, 0, sizeof(T));
+		memset(&m_shadow, 0, sizeof(T));
+	}
+	// Read the struct from the file, or if the file does not hold one yet write
+	// the struct as it is and return false
+	bool load()
+	{
+		m_bLoaded = true;
+		if (m_file.fReadAt(0, &m_data, sizeof(T)) == sizeof(T))
+		{
+			m_shadow = m_data;
+			return true;
+		}
+		m_file.fWriteAt(0, &m_data, sizeof(T));
+		m_shadow = m_data;
+		return false;
+	}
+	// Nothing is written before load()
+	uint32 sync()
+	{
+		if (!m_bLoaded)
+			return 0;
+		return m_file.fWriteChanged(&m_data, &m_shadow, sizeof(T));
+	}
+	T& Data()
+	{
+		return m_data;
+	}
+	T* operator->()
+	{
+		return &m_data;
+	}
+};
+
+// Named values in one file, an open addressing hash table of fixed size slots, with a
+// table of a byte of each slot's key hash ahead of them. A value of up to valueSize bytes
+// is read with one transfer after the tags along its probe, a new key takes two writes in
+// one write session and a change or erase one. keyIndex() keeps the tags in RAM, so slots
+// holding other keys are skipped without reading anything, and most misses need no reads.
+class SFFS_KV
+{
+private:
+	SFFS_File& m_file;
+	SFFS_KV_HEAD m_head;
+	uint8* m_pTags;
+public:
+	SFFS_KV(SFFS_File& file) :
+			m_file(file),
+			m_pTags(NULL)
+	{
+		memset(&m_head, 0, sizeof(m_head));
+	}
+	// A new file with room for 'buckets' keys, or one made before. put() fills every
+	// bucket, but probes stay short with about a third more buckets than keys.
+	bool create(const char* fileName, uint16 buckets, uint16 valueSize);
+	bool open(const char* fileName);
+	// A byte per bucket, read from the file in one transfer, after create() or open(). NULL
+	// turns it off.
+	bool keyIndex(uint8* pTags, uint16 size);
+	// get() copies up to 'size' bytes of the value and sets *pLen to its full length.
+	// Slots read on the way may leave other values in pValue when the key is not found.
+	bool get(const char* key, void* pValue, uint16 size, uint16* pLen=NULL);
+	bool put(const char* key, const void* pValue, uint16 len);
+	bool erase(const char* key);
+	uint16 Buckets()
+	{
+		return m_head.buckets;
+	}
+	uint16 ValueSize()
+	{
+		return m_head.valueSize;
+	}
+
+private:
+	uint32 _tagOffset(uint16 bucket)
+	{
+		return sizeof(m_head)+bucket;
+	}
+	uint32 _slotOffset(uint16 bucket)
+	{
+		return sizeof(m_head)+m_head.buckets+(uint32)bucket*(sizeof(SFFS_KV_SLOT)+m_head.valueSize);
+	}
+	static bool _keyCopy(char* pDest, const char* key);
+	static uint32 _hash(const char* key);
+	static uint8 _tag(uint32 hash);
+	int32 _find(const char* key, SFFS_KV_SLOT* pSlot, void* pValue, uint16 size, int32* pFree);
+};
+
+
 class SFFS_Volume
 {
 private:
-	char m_volumeName[SFFS_FILE_NAME_BUFFER_LEN];
-	uint32 m_magic;
+	SFFS_VOLUME_HEAD m_head;
 	uint32 m_volumeSize;
-	uint32 m_fileCount;
-	uint32 m_dataMemStart;
+	cIO_DRV& m_driver;
+#if SFFS_CACHE_LINES > 0
+	SFFS_CachedStream m_ios;
+#else
 	SFFS_Stream m_ios;
+#endif
+#if SFFS_DIR_CACHE_SIZE > 0
+	uint16 m_dirHash[SFFS_DIR_CACHE_SIZE];
+#endif
+	// Free extents, loaded from the deleted file headers when first needed
+	SFFS_FREE_EXTENT m_free[SFFS_FREE_EXTENTS];
+	uint8 m_freeCount;
+	bool m_bFreeLoaded;
+	int m_emptySlot;			// A deleted file header with no space left, reused before adding one
+	uint16 m_generation;		// Counts files moved by Compact()
+	// The file Compact() is copying, from m_moveFrom to m_moveTo in free extent m_moveHole
+	int m_moveIndex;
+	uint8 m_moveHole;
+	uint32 m_moveFrom;
+	uint32 m_moveTo;
+	uint32 m_moveSize;
+	uint32 m_moveDone;
+	// Queued file reads and writes, oldest first
+	SFFS_REQUEST* m_pAsyncHead;
+	SFFS_REQUEST* m_pAsyncTail;
+#if SFFS_STATS
+	SFFS_VOLUME_STATS m_stats;
+#endif
 public:
 
 	SFFS_Volume(cIO_DRV& driver) : 
-			m_magic(0),
 			m_volumeSize(0),
-			m_fileCount(0),
-			m_dataMemStart(0),
-			m_ios(driver)
+			m_driver(driver),
+			m_ios(driver),
+			m_generation(0),
+			m_pAsyncHead(NULL),
+			m_pAsyncTail(NULL)
 	{
+		m_head.magic = 0;
+		m_head.fileCount = 0;
+		m_head.dataMemStart = 0;
+		_freeReset();
+#if SFFS_STATS
+		// The driver may not be constructed yet, it starts with its own counts clear
+		m_ios.CountInto(&m_stats, &m_head.dataMemStart);
+		memset(&m_stats, 0, sizeof(m_stats));
+#endif
 	}
 
 	void debug(bool bOnOff);
@@ -293,10 +1056,56 @@ public:
 			return 0;
 		return m_volumeSize;
 	}
+	// Free space for files, including what deleted files have left
 	uint32 VolumeFree();
+	// Move up to maxBytes of file data, so the space deleted files leave is gathered at
+	// the bottom of the data area. Returns false once there is nothing left it can do.
+	// A file is only moved into a free extent it fits in whole, and stays readable and
+	// writable throughout, so Compact() can be called from the main loop at any time.
+	bool Compact(uint32 maxBytes=SFFS_COMPACT_STEP);
+	// Write anything the stream is holding back to the FRAM
+	void VolumeSync()
+	{
+		AsyncWait();
+		m_ios.Flush();
+	}
+	// Move up to maxBytes of the queued file reads and writes, calling each one's
+	// pfnDone as it finishes. Returns true while there are requests queued.
+	bool Poll(uint32 maxBytes=SFFS_ASYNC_STEP);
+	// Finish everything queued
+	void AsyncWait()
+	{
+		while (Poll())
+		{
+		}
+	}
+#if SFFS_CACHE_LINES > 0
+	SFFS_CACHE_STATS& CacheStats()
+	{
+		return m_ios.Stats();
+	}
+	void CacheStatsReset()
+	{
+		m_ios.ResetStats();
+	}
+#endif
+#if SFFS_STATS
+	// What this volume has done since the last reset, with the bus counts read from the driver
+	SFFS_VOLUME_STATS& VolumeStats()
+	{
+		memset(&m_stats.bus, 0, sizeof(m_stats.bus));
+		m_driver.AddBusStats(&m_stats.bus);
+		return m_stats;
+	}
+	void VolumeStatsReset()
+	{
+		memset(&m_stats, 0, sizeof(m_stats));
+		m_driver.ResetBusStats();
+	}
+#endif
 	const char* VolumeName()
 	{
-		return (m_magic == SFFS_MAGIC_INT) ? m_volumeName : NULL;
+		return (m_head.magic == SFFS_MAGIC_INT || m_head.magic == SFFS_MAGIC_INT_V2 || m_head.magic == SFFS_MAGIC_INT_V1) ? m_head.volumeName : NULL;
 	}
 	//
 	// File operations
@@ -307,54 +1116,152 @@ public:
 	}
 	uint FileCount()
 	{
-		return m_fileCount;
+		return m_head.fileCount;
+	}
+	bool FileExists(const char* fileName)
+	{
+		return (_findFile(fileName) != -1);
+	}
+	// Where the file headers start, and how far apart they are, on this volume
+	uint32 FileMemStart()
+	{
+		return _volumeHeadSize();
+	}
+	uint32 FileHeadSize()
+	{
+		return _fileHeadSize();
 	}
 //protected friend
-	bool fileCreate(SFFS_File* pFile, const char* fileName, uint32 maxSize);
+	bool fileCreate(SFFS_File* pFile, const char* fileName, uint32 maxSize, uint16 flags=0, uint16 param=0);
 	bool fileOpen(SFFS_File* pFile, const char* fileName);
+	bool fileDelete(SFFS_File* pFile);
+	void asyncQueue(SFFS_REQUEST* pReq);
+	void fileWritten(uint index)
+	{
+		// A file being moved is copied again from the start
+		if (m_moveIndex == (int)index)
+			m_moveDone = 0;
+	}
+	uint16 Generation()
+	{
+		return m_generation;
+	}
+#if SFFS_STATS
+	void statsTime(uint8 op, uint32 us);
+#endif
 protected:
 	bool			init();
 private:
 	bool 			_start();
 	uint8 			_init(uint32 framAddrWidth);
-	int 			_findFile(const char* fileName);
+	int 			_findFile(const char* fileName, uint first=0, bool bConfirm=true);
+	void			_dirBuild();
+	void			_dirAdd(uint index, const char* fileName);
 	uint32 			_readBack(uint32 addr, uint32 data);
 	uint32 			_volumeSize();
 	bool 			_volumeOpen();
 	void 			_volumeCommit();
+	void 			_volumeRepair();
 	void			_printDbgNum(uint32 num);
+	void			_readHead(uint index, SFFS_FILE_HEAD* pHead);
+	void			_writeHead(uint index, SFFS_FILE_HEAD* pHead);
+	void			_freeReset();
+	bool			_freeLoad();
+	void			_freeAdd(uint index, uint32 offset, uint32 size);
+	void			_freeRemove(uint hole);
+	int				_freeFit(uint32 size);
+	void			_freeRecover(uint index, SFFS_FILE_HEAD* pHead);
+	void			_freeRelease(uint index, SFFS_FILE_HEAD* pHead);
+	void			_freeShrink(uint hole, uint32 size);
+	bool			_moveStart();
+	void			_moveFinish();
+
+	// Free between the file headers and the file data
+	uint32 _freeLow()
+	{
+		return m_head.dataMemStart-(FileMemStart()+(m_head.fileCount*FileHeadSize()));
+	}
+	// Deleted file headers with no space, or space given back to the bottom of the data area
+	bool _isEmpty(SFFS_FILE_HEAD* pHead)
+	{
+		return (pHead->flags & SFFS_FILE_FREE) && (pHead->dataMaxSize==0 || pHead->dataOffset < m_head.dataMemStart);
+	}
+
+	// Version 1 volume headers end with their second magic, where volumeSize is now
+	uint32 _volumeHeadSize()
+	{
+		return (m_head.magic == SFFS_MAGIC_INT_V1) ? offsetof(SFFS_VOLUME_HEAD, volumeSize)+sizeof(m_head.magic2) : sizeof(m_head);
+	}
+	// Version 1 and 2 file headers stop short of the file type fields
+	uint32 _fileHeadSize()
+	{
+		return (m_head.magic == SFFS_MAGIC_INT) ? sizeof(SFFS_FILE_HEAD) : offsetof(SFFS_FILE_HEAD, aux);
+	}
 };
 
-class SFFS_Volume_SPI : public SFFS_Volume
+// A volume and the driver it owns, begin() passes its arguments to the driver's Init()
+// and mounts. Driver() returns it as its own type, and with cIO_DRV_SPI_T the address
+// width can be fixed, e.g. SFFS_VolumeT< cIO_DRV_SPI_T<3> >. File I/O still reaches the
+// driver through cIO_DRV&, one virtual call per transfer.
+template <class DRV>
+class SFFS_VolumeT : public SFFS_Volume
 {
 private:
-	cIO_DRV_SPI m_drv;
+	DRV m_drv;
 public:
-	SFFS_Volume_SPI() : SFFS_Volume(m_drv)
+	SFFS_VolumeT() : SFFS_Volume(m_drv)
 	{
 	}
-	bool begin(uint8 csPin, uint8 addrWidth=2)
+	template <typename... ARGS>
+	bool begin(ARGS... args)
 	{
-		if (m_drv.Init(csPin, addrWidth))
+		if (m_drv.Init(args...))
 			return init();
 		return false;
 	}
+	DRV& Driver()
+	{
+		return m_drv;
+	}
 };
 
-class SFFS_Volume_I2C : public SFFS_Volume
+// begin(uint8 csPin, uint8 addrWidth=2)
+typedef SFFS_VolumeT<cIO_DRV_SPI> SFFS_Volume_SPI;
+// begin(uint8 hwAddr)
+typedef SFFS_VolumeT<cIO_DRV_I2C> SFFS_Volume_I2C;
+// One volume across several identical FRAMs, see cIO_DRV_Striped. The devices are
+// Init()ed first, and always given in the same order to
+// begin(cIO_DRV** pDevices, uint8 count, uint32 stripeSize=256)
+typedef SFFS_VolumeT<cIO_DRV_Striped> SFFS_Volume_Striped;
+
+// Several mounted volumes, on any mix of SPI and I2C FRAMs, found by name. Each volume
+// has its own driver and geometry, so nothing is shared between them.
+class SFFS_VolumeManager
 {
 private:
-	cIO_DRV_I2C m_drv;
+	SFFS_Volume* m_pVolumes[SFFS_MAX_VOLUMES];
+	uint m_count;
 public:
-	SFFS_Volume_I2C() : SFFS_Volume(m_drv)
+	SFFS_VolumeManager() :
+			m_count(0)
 	{
 	}
-	bool begin(uint8 hwAddr)
+	// Add a volume begin() has mounted, false if it holds no volume or there is no room
+	bool Mount(SFFS_Volume& volume);
+	// Write out what the volume holds back and forget it
+	void Unmount(SFFS_Volume& volume);
+	uint Count()
 	{
-		if (m_drv.Init(hwAddr))
-			return init();
-		return false;
+		return m_count;
+	}
+	SFFS_Volume* Volume(uint index)
+	{
+		return (index<m_count) ? m_pVolumes[index] : NULL;
 	}
+	SFFS_Volume* Find(const char* volumeName);
+	// The first volume holding the file
+	SFFS_Volume* FindFile(const char* fileName);
+	void Sync();
 };
 
 #endif //_SFFS_H
\ No newline at end of file
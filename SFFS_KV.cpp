@@ -0,0 +1,244 @@
+/**************************************************************************/
+/*!
+    @file     SFFS_KV.cpp
+    @author   Paul Holmes
+    @license  BSD (see LICENSE)
+
+    Simple FRam File System
+
+    Key-value store in a single SFFS file, see SFFS_KV in SFFS.h
+*/
+/**************************************************************************/
+#include "SFFS.h"
+
+// Keys are held padded with zeros to the full slot width, so compare as one block
+//static
+bool
+SFFS_KV::_keyCopy(char* pDest, const char* key)
+{
+	memset(pDest, 0, SFFS_KV_KEY_LEN);
+	return key[0] != '\0' && SFFS_Tools::strcpy(pDest, key, SFFS_KV_KEY_LEN);
+}
+
+// FNV-1a
+//static
+uint32
+SFFS_KV::_hash(const char* key)
+{
+	uint32 hash = 2166136261UL;
+	while (*key != '\0')
+	{
+		hash ^= (uint8)*key++;
+		hash *= 16777619UL;
+	}
+	return hash;
+}
+
+// The top byte of the hash, moved clear of the empty and erased tags
+//static
+uint8
+SFFS_KV::_tag(uint32 hash)
+{
+	uint8 tag = (uint8)(hash >> 24);
+	return (tag <= SFFS_KV_ERASED) ? tag+2 : tag;
+}
+
+// The header, then zeros over the tags and every slot, in contiguous ranges that go out a batch
+// per transfer
+bool
+SFFS_KV::create(const char* fileName, uint16 buckets, uint16 valueSize)
+{
+	uint8 zero[32];
+	sIO_VEC vec[SFFS_IOV_BATCH];
+
+	m_pTags = NULL;
+	memset(&m_head, 0, sizeof(m_head));
+	if (buckets==0)
+		return false;
+	m_head.buckets = buckets;
+	m_head.valueSize = valueSize;
+	uint32 size = _slotOffset(buckets);
+	if (!m_file.fCreate(fileName, size))
+	{
+		memset(&m_head, 0, sizeof(m_head));
+		return false;
+	}
+	memset(zero, 0, sizeof(zero));
+	m_head.magic = SFFS_KV_MAGIC;
+	m_file.fWrite(&m_head, sizeof(m_head));
+	for (uint32 offset=sizeof(m_head); offset<size; )
+	{
+		uint n = 0;
+		for (; offset<size && n<SFFS_IOV_BATCH; n++)
+		{
+			vec[n].offset = offset;
+			vec[n].pBuf = zero;
+			vec[n].count = (size-offset > sizeof(zero)) ? sizeof(zero) : size-offset;
+			offset += vec[n].count;
+		}
+		m_file.fWriteV(vec, n);
+	}
+	return m_file.fSize()==size;
+}
+
+bool
+SFFS_KV::open(const char* fileName)
+{
+	m_pTags = NULL;
+	if (m_file.fOpen(fileName) && m_file.fReadAt(0, &m_head, sizeof(m_head))==sizeof(m_head) &&
+		m_head.magic==SFFS_KV_MAGIC && m_head.buckets > 0 && m_file.fSize() >= _slotOffset(m_head.buckets))
+		return true;
+	memset(&m_head, 0, sizeof(m_head));
+	return false;
+}
+
+bool
+SFFS_KV::keyIndex(uint8* pTags, uint16 size)
+{
+	m_pTags = NULL;
+	if (pTags==NULL)
+		return true;
+	if (m_head.buckets==0 || size < m_head.buckets)
+		return false;
+	if (m_file.fReadAt(_tagOffset(0), pTags, m_head.buckets) != m_head.buckets)
+		return false;
+	m_pTags = pTags;
+	return true;
+}
+
+// Probe on from the key's bucket to an empty slot. Returns the bucket holding the key,
+// or -1, and sets *pFree to the first empty or erased bucket passed (-1 if none). Without
+// keyIndex() the tags are read SFFS_KV_PROBE_TAGS at a time. Each slot read brings up to
+// 'size' bytes of its value with it, in the same transfer.
+int32
+SFFS_KV::_find(const char* key, SFFS_KV_SLOT* pSlot, void* pValue, uint16 size, int32* pFree)
+{
+	uint8 probe[SFFS_KV_PROBE_TAGS];
+	uint16 probeStart = 0;
+	uint16 probeCount = 0;
+	uint32 hash = _hash(key);
+	uint8 tag = _tag(hash);
+	uint16 bucket = hash % m_head.buckets;
+
+	*pFree = -1;
+	if (size > m_head.valueSize)
+		size = m_head.valueSize;
+	for (uint16 i=0; i<m_head.buckets; i++)
+	{
+		uint8 have;
+		if (m_pTags)
+			have = m_pTags[bucket];
+		else
+		{
+			// The next tags, up to the end of the table
+			if (bucket < probeStart || bucket >= probeStart+probeCount)
+			{
+				probeStart = bucket;
+				probeCount = m_head.buckets-bucket;
+				if (probeCount > sizeof(probe))
+					probeCount = sizeof(probe);
+				if (m_file.fReadAt(_tagOffset(bucket), probe, probeCount) != probeCount)
+					return -1;
+			}
+			have = probe[bucket-probeStart];
+		}
+		if (have==tag)
+		{
+			uint32 offset = _slotOffset(bucket);
+			sIO_VEC vec[2] = {
+				{ offset, pSlot, sizeof(*pSlot) },
+				{ (uint32)(offset+sizeof(*pSlot)), pValue, size }
+			};
+			if (m_file.fReadV(vec, (pValue && size) ? 2 : 1) < sizeof(*pSlot))
+				return -1;
+			if (memcmp(pSlot->key, key, SFFS_KV_KEY_LEN)==0)
+				return bucket;
+		}
+		if (have==SFFS_KV_EMPTY || have==SFFS_KV_ERASED)
+		{
+			if (*pFree < 0)
+				*pFree = bucket;
+			// Nothing was ever put past an empty slot
+			if (have==SFFS_KV_EMPTY)
+				return -1;
+		}
+		if (++bucket==m_head.buckets)
+			bucket = 0;
+	}
+	return -1;
+}
+
+bool
+SFFS_KV::get(const char* key, void* pValue, uint16 size, uint16* pLen)
+{
+	char name[SFFS_KV_KEY_LEN];
+	SFFS_KV_SLOT slot;
+	int32 hole;
+
+	if (m_head.buckets==0 || !_keyCopy(name, key) || _find(name, &slot, pValue, size, &hole) < 0)
+		return false;
+	if (pLen)
+		*pLen = slot.len;
+	return true;
+}
+
+// The length, key and value go out in one transfer, then for a new key the tag, all
+// through one fWriteV() so they share a write session
+bool
+SFFS_KV::put(const char* key, const void* pValue, uint16 len)
+{
+	char name[SFFS_KV_KEY_LEN];
+	SFFS_KV_SLOT slot;
+	int32 hole;
+
+	if (m_head.buckets==0 || len > m_head.valueSize || !_keyCopy(name, key))
+		return false;
+	int32 bucket = _find(name, &slot, NULL, 0, &hole);
+	bool bNew = (bucket < 0);
+	if (bNew)
+	{
+		if (hole < 0)
+			return false;
+		bucket = hole;
+	}
+	slot.len = len;
+	memcpy(slot.key, name, SFFS_KV_KEY_LEN);
+	uint32 offset = _slotOffset((uint16)bucket);
+	uint8 tag = _tag(_hash(name));
+	sIO_VEC vec[3] = {
+		{ offset, &slot, sizeof(slot) },
+		{ (uint32)(offset+sizeof(slot)), (void*)pValue, len },
+		{ _tagOffset((uint16)bucket), &tag, sizeof(tag) }
+	};
+	// The ranges go out in order, the tag last
+	uint n = (len) ? 2 : 1;
+	if (bNew)
+		vec[n++] = vec[2];
+	if (m_file.fWriteV(vec, n) != sizeof(slot)+len+((bNew) ? sizeof(tag) : 0))
+		return false;
+	if (bNew && m_pTags)
+		m_pTags[bucket] = tag;
+	return true;
+}
+
+// The slot is marked erased rather than empty, so keys probed past it are still found
+bool
+SFFS_KV::erase(const char* key)
+{
+	char name[SFFS_KV_KEY_LEN];
+	SFFS_KV_SLOT slot;
+	int32 hole;
+
+	if (m_head.buckets==0 || !_keyCopy(name, key))
+		return false;
+	int32 bucket = _find(name, &slot, NULL, 0, &hole);
+	if (bucket < 0)
+		return false;
+	uint8 tag = SFFS_KV_ERASED;
+	sIO_VEC vecTag = { _tagOffset((uint16)bucket), &tag, sizeof(tag) };
+	if (m_file.fWriteV(&vecTag, 1) != sizeof(tag))
+		return false;
+	if (m_pTags)
+		m_pTags[bucket] = tag;
+	return true;
+}
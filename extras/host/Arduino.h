@@ -0,0 +1,67 @@
+/**************************************************************************/
+/*!
+    @file     Arduino.h
+    @author   Paul Holmes
+    @license  BSD (see LICENSE)
+
+    Host (Linux) stand-in for the Arduino core, just enough of it to build
+    SFFS and its drivers against the simulated FRAM in sim_fram.h.
+
+    Time is simulated, micros()/millis() return the time the simulated
+    buses have spent moving data, not the wall clock.
+*/
+/**************************************************************************/
+#ifndef _sim_Arduino_h
+#define _sim_Arduino_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT  0x0
+#define OUTPUT 0x1
+
+#define DEC 10
+#define HEX 16
+
+#define F(s) (s)
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+
+unsigned long micros();
+unsigned long millis();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+class HardwareSerial
+{
+public:
+	void begin(unsigned long baud) { (void)baud; }
+	operator bool() { return true; }
+	int available() { return 0; }
+	int read() { return -1; }
+
+	size_t print(const char* s);
+	size_t print(char c);
+	size_t print(int n, int base=DEC) { return print((long)n, base); }
+	size_t print(unsigned int n, int base=DEC) { return print((unsigned long)n, base); }
+	size_t print(long n, int base=DEC);
+	size_t print(unsigned long n, int base=DEC);
+	size_t print(double n, int digits=2);
+	size_t println();
+	template<typename T> size_t println(T v) { size_t n = print(v); return n + println(); }
+	template<typename T> size_t println(T v, int fmt) { size_t n = print(v, fmt); return n + println(); }
+};
+
+extern HardwareSerial Serial;
+
+#endif //_sim_Arduino_h
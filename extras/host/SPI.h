@@ -0,0 +1,71 @@
+/**************************************************************************/
+/*!
+    @file     SPI.h
+    @author   Paul Holmes
+    @license  BSD (see LICENSE)
+
+    Host stand-in for the AVR core SPI library. Bytes are clocked into
+    whichever simulated FRAM currently has its CS pin driven LOW, and the
+    time each call would take on the real bus is charged to that device.
+*/
+/**************************************************************************/
+#ifndef _sim_SPI_h
+#define _sim_SPI_h
+
+#include "Arduino.h"
+
+#define SPI_HAS_TRANSACTION 1
+
+#define SPI_CLOCK_DIV4   0x00
+#define SPI_CLOCK_DIV16  0x01
+#define SPI_CLOCK_DIV64  0x02
+#define SPI_CLOCK_DIV128 0x03
+#define SPI_CLOCK_DIV2   0x04
+#define SPI_CLOCK_DIV8   0x05
+#define SPI_CLOCK_DIV32  0x06
+
+#define SPI_MODE0 0x00
+#define SPI_MODE1 0x04
+#define SPI_MODE2 0x08
+#define SPI_MODE3 0x0C
+
+#define LSBFIRST 0
+#define MSBFIRST 1
+
+class SPISettings
+{
+public:
+	SPISettings(uint32_t clock=4000000, uint8_t bitOrder=MSBFIRST, uint8_t dataMode=SPI_MODE0) :
+			m_clock(clock)
+	{
+		(void)bitOrder;
+		(void)dataMode;
+	}
+	uint32_t m_clock;
+};
+
+class SPIClass
+{
+public:
+	SPIClass();
+
+	void begin();
+	void end();
+	void beginTransaction(SPISettings settings);
+	void endTransaction();
+	void setClockDivider(uint8_t div);
+	void setDataMode(uint8_t mode) { (void)mode; }
+	void setBitOrder(uint8_t order) { (void)order; }
+
+	uint8_t transfer(uint8_t data);
+	void transfer(void* pBuf, size_t count);
+
+	// Simulation only
+	uint32_t Clock() { return m_clock; }
+private:
+	uint32_t m_clock;
+};
+
+extern SPIClass SPI;
+
+#endif //_sim_SPI_h
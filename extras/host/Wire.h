@@ -0,0 +1,57 @@
+/**************************************************************************/
+/*!
+    @file     Wire.h
+    @author   Paul Holmes
+    @license  BSD (see LICENSE)
+
+    Host stand-in for the AVR core Wire library, including its 32 byte
+    buffer limit. Transmissions are delivered to the simulated FRAM that
+    answers the device address, and bus time is charged to it.
+*/
+/**************************************************************************/
+#ifndef _sim_Wire_h
+#define _sim_Wire_h
+
+#include "Arduino.h"
+
+// Buffer size of the AVR core, SIM_WIRE_BUFFER_LENGTH models the larger ones
+#ifndef SIM_WIRE_BUFFER_LENGTH
+#define SIM_WIRE_BUFFER_LENGTH 32
+#endif
+#define BUFFER_LENGTH SIM_WIRE_BUFFER_LENGTH
+// Reserved address used to read an I2C device's ID
+#define SIM_I2C_DEVICE_ID_ADDRESS 0x7C
+
+class TwoWire
+{
+public:
+	TwoWire();
+
+	void begin();
+	void end() {}
+	void setClock(uint32_t clock) { m_clock = clock; }
+
+	void beginTransmission(uint8_t address);
+	uint8_t endTransmission(uint8_t sendStop=true);
+	size_t write(uint8_t data);
+	size_t write(const uint8_t* pData, size_t count);
+
+	uint8_t requestFrom(uint8_t address, uint8_t quantity, uint8_t sendStop=true);
+	int available();
+	int read();
+
+	// Simulation only
+	uint32_t Clock() { return m_clock; }
+private:
+	uint32_t m_clock;
+	uint8_t m_txAddress;
+	uint8_t m_txBuffer[BUFFER_LENGTH];
+	uint8_t m_txLength;
+	uint8_t m_rxBuffer[BUFFER_LENGTH];
+	uint8_t m_rxLength;
+	uint8_t m_rxIndex;
+};
+
+extern TwoWire Wire;
+
+#endif //_sim_Wire_h
@@ -0,0 +1,1397 @@
+/**************************************************************************/
+/*!
+    @file     sffs_bench.cpp
+    @author   Paul Holmes
+    @license  BSD (see LICENSE)
+
+    SFFS host benchmark, reports the bus cost of the file system operations
+    on simulated SPI and I2C FRAM.
+
+    For each operation: bus transactions (CS assertions / I2C STARTs),
+    bytes clocked on the bus including commands and addresses, and the
+    simulated time in microseconds, all per call.
+*/
+/**************************************************************************/
+#include <SPI.h>
+#include <Wire.h>
+#include <time.h>
+#include "sffs_sim.h"
+
+#define BENCH_FILES 60
+#define BENCH_SMALL_FILE 64
+#define BENCH_DATA_FILE 8192
+
+static int s_failures = 0;
+
+class cMeasure
+{
+private:
+	cFRAM_Sim& m_fram;
+	sSimStats m_start;
+public:
+	cMeasure(cFRAM_Sim& fram) :
+			m_fram(fram)
+	{
+		Start();
+	}
+	void Start()
+	{
+		m_start = m_fram.Stats();
+	}
+	void Stop(const char* label, uint32 calls=1)
+	{
+		sSimStats& end = m_fram.Stats();
+		printf("  %-32s %8.1f %10.1f %12.1f\n", label,
+			(double)(end.transactions-m_start.transactions)/calls,
+			(double)(end.busBytes-m_start.busBytes)/calls,
+			(end.us-m_start.us)/calls);
+		Start();
+	}
+};
+
+static void
+_header(const char* title)
+{
+	printf("\n%s\n", title);
+	printf("  %-32s %8s %10s %12s\n", "operation", "txns", "bus bytes", "sim us");
+}
+
+static void
+_check(bool bOk, const char* what)
+{
+	if (!bOk)
+	{
+		printf("  FAIL: %s\n", what);
+		s_failures++;
+	}
+}
+
+static void
+_fill(uint8* pBuf, uint32 count, uint8 seed)
+{
+	for (uint32 i=0; i<count; i++)
+		pBuf[i] = (uint8)(seed + i*7);
+}
+
+static void
+bench_init(eSimBus bus, uint32 framSize)
+{
+	const char* busName = (bus==SIM_BUS_SPI) ? "SPI" : "I2C";
+	char label[48];
+	SFFS_Volume_Sim vol;
+
+	// A part that can not report its ID has to be probed
+	vol.begin(bus, framSize, 0, false);
+	_check(vol.VolumeSize()==0 && vol.Driver().Fram().Size()==framSize, "blank FRAM");
+	cMeasure m(vol.Driver().Fram());
+	vol.restart();
+	snprintf(label, sizeof(label), "init() blank %s %luK, no ID", busName, (unsigned long)(framSize/1024));
+	m.Stop(label);
+	vol.VolumeCreate("Bench");
+	_check(vol.VolumeSize()==framSize, "probed size");
+
+	vol.begin(bus, framSize);
+	m.Start();
+	vol.restart();
+	snprintf(label, sizeof(label), "init() blank %s %luK", busName, (unsigned long)(framSize/1024));
+	m.Stop(label);
+
+	vol.VolumeCreate("Bench");
+	m.Start();
+	vol.restart();
+	snprintf(label, sizeof(label), "init() mounted %s %luK", busName, (unsigned long)(framSize/1024));
+	m.Stop(label);
+	_check(vol.VolumeName()!=NULL && vol.VolumeSize()==framSize, "volume size");
+
+	// A damaged header is still mounted, its size is found again and the header put right,
+	// so the next header write does not seal the damaged size
+	SFFS_File file(vol);
+	vol.Driver().Fram().Mem()[offsetof(SFFS_VOLUME_HEAD, volumeSize)+1] ^= 0x40;
+	m.Start();
+	vol.restart();
+	snprintf(label, sizeof(label), "init() bad checksum %s %luK", busName, (unsigned long)(framSize/1024));
+	m.Stop(label);
+	_check(vol.VolumeName()!=NULL && vol.VolumeSize()==framSize, "bad checksum");
+	_check(file.fCreate("after", 16) && vol.restart() && vol.VolumeSize()==framSize && file.fOpen("after"), "bad checksum repaired");
+	// A data area outside the FRAM leaves nothing in the header to trust
+	vol.Driver().Fram().Mem()[offsetof(SFFS_VOLUME_HEAD, dataMemStart)+3] ^= 0x40;
+	_check(vol.restart() && vol.VolumeName()==NULL && !file.fOpen("after"), "bad checksum not mounted");
+}
+
+// Version 1 volumes (no cached size in the header) still mount and work
+static void
+bench_v1_volume()
+{
+	static const uint8 v1Head[32] = { 'F','S','0','1', 'O','l','d',0,0,0,0,0,0,0,0,0,0,0,0,0,
+										1,0,0,0, 0xF0,0x7F,0,0, 'F','S','0','1' };
+	static const uint8 v1File[28] = { 'o','l','d',0,0,0,0,0,0,0,0,0,0,0,0,0,
+										0xF0,0x7F,0,0, 0x10,0,0,0, 4,0,0,0 };
+	SFFS_Volume_Sim vol;
+	SFFS_File file(vol);
+	char data[4];
+
+	vol.begin(SIM_BUS_SPI, 32768);
+	uint8* pMem = vol.Driver().Fram().Mem();
+	memcpy(pMem, v1Head, sizeof(v1Head));
+	memcpy(pMem+sizeof(v1Head), v1File, sizeof(v1File));
+	memcpy(pMem+0x7FF0, "abc", 4);
+	vol.restart();
+	_check(vol.VolumeName()!=NULL && vol.VolumeSize()==32768 && vol.FileCount()==1, "v1 mount");
+	_check(file.fOpen("old") && file.fReadAt(0, data, 4)==4 && memcmp(data, "abc", 4)==0, "v1 read");
+	_check(file.fCreate("new", 16) && vol.restart() && file.fOpen("old") && file.fOpen("new"), "v1 create");
+	_check(memcmp(pMem, v1Head, 4)==0 && memcmp(pMem+28, "FS01", 4)==0, "v1 header kept");
+}
+
+// A 32KB version 2 volume "Two" holding files "a" and "b" ("bbb")
+static void
+_v2Image(uint8* pMem)
+{
+	SFFS_VOLUME_HEAD head = { SFFS_MAGIC_INT_V2, "Two", 2, 0x8000-32, 0x8000, 0, SFFS_MAGIC_INT_V2 };
+	SFFS_FILE_HEAD files[2] = { { "a", 0x8000-16, 16, 4 }, { "b", 0x8000-32, 16, 4 } };
+
+	head.checksum = SFFS_Tools::checksum(&head, offsetof(SFFS_VOLUME_HEAD, checksum));
+	memcpy(pMem, &head, sizeof(head));
+	for (uint i=0; i<2; i++)
+		memcpy(pMem+sizeof(head)+(i*offsetof(SFFS_FILE_HEAD, aux)), &files[i], offsetof(SFFS_FILE_HEAD, aux));
+	memcpy(pMem+0x8000-32, "bbb", 4);
+}
+
+// Version 2 volumes have 28 byte file headers, they still work for plain files
+static void
+bench_v2_volume()
+{
+	SFFS_Volume_Sim vol;
+	SFFS_File file(vol);
+	char data[4];
+
+	vol.begin(SIM_BUS_SPI, 32768);
+	uint8* pMem = vol.Driver().Fram().Mem();
+	_v2Image(pMem);
+	vol.restart();
+	_check(vol.VolumeName()!=NULL && vol.VolumeSize()==32768 && vol.FileCount()==2, "v2 mount");
+	_check(file.fOpen("b") && file.fReadAt(0, data, 4)==4 && memcmp(data, "bbb", 4)==0, "v2 read");
+	_check(!file.fCreate("log", 64, SFFS_FILE_LOG), "v2 no file types");
+	_check(file.fCreate("c", 16) && vol.restart() && file.fOpen("c") && file.fOpen("b") && file.fOpen("a"), "v2 create");
+	_check(memcmp(pMem, "FS02", 4)==0, "v2 header kept");
+}
+
+static uint32 s_asyncDone = 0;
+
+static void
+_asyncDone(SFFS_REQUEST* pReq)
+{
+	s_asyncDone += pReq->done;
+}
+
+// A 4KB snapshot written and read back through the request queue, a piece per Poll()
+static void
+bench_async(eSimBus bus, uint32 framSize)
+{
+	static uint8 wbuf[4096];
+	static uint8 rbuf[4096];
+	SFFS_Volume_Sim vol;
+	SFFS_File file(vol);
+	SFFS_REQUEST write;
+	SFFS_REQUEST read;
+
+	memset(&write, 0, sizeof(write));
+	memset(&read, 0, sizeof(read));
+	vol.begin(bus, framSize);
+	vol.VolumeCreate("Bench");
+	cMeasure m(vol.Driver().Fram());
+	_check(file.fCreate("snap", sizeof(wbuf)), "fCreate snap");
+	_fill(wbuf, sizeof(wbuf), 3);
+	m.Start();
+	file.fWrite(wbuf, sizeof(wbuf));
+	m.Stop("fWrite 4096, blocking");
+
+	_fill(wbuf, sizeof(wbuf), 9);
+	s_asyncDone = 0;
+	m.Start();
+	_check(file.fWriteAsync(&write, 0, wbuf, sizeof(wbuf), _asyncDone) && file.fReadAsync(&read, 0, rbuf, sizeof(rbuf), _asyncDone), "queue");
+	_check(!file.fReadAsync(&read, 0, rbuf, sizeof(rbuf)), "queued twice");
+	m.Stop("fWriteAsync+fReadAsync");
+	sSimStats& stats = vol.Driver().Fram().Stats();
+	double longest = 0;
+	uint calls = 0;
+	bool bMore = true;
+	m.Start();
+	while (bMore)
+	{
+		double start = stats.us;
+		bMore = vol.Poll();
+		calls++;
+		if (stats.us-start > longest)
+			longest = stats.us-start;
+	}
+	m.Stop("Poll(), 64 bytes", calls);
+	printf("  %-32s %8s %10s %12.1f\n", "Poll() longest call", "", "", longest);
+	_check(calls==(2*sizeof(wbuf))/SFFS_ASYNC_STEP, "poll calls");
+	_check(write.state==SFFS_REQ_DONE && read.state==SFFS_REQ_DONE && s_asyncDone==2*sizeof(wbuf), "async done");
+	_check(memcmp(rbuf, wbuf, sizeof(rbuf))==0, "read queued behind write");
+
+	// A read-ahead window filled between the pieces of a write is not read from again
+	static uint8 ahead[256];
+	file.fReadAhead(ahead, sizeof(ahead));
+	_fill(wbuf, 512, 11);
+	_check(file.fWriteAsync(&write, 0, wbuf, 512), "queue under read-ahead");
+	vol.Poll();
+	file.fSeek(128);
+	file.fRead(rbuf, 16);
+	vol.AsyncWait();
+	file.fSeek(192);
+	_check(file.fRead(rbuf, 16)==16 && memcmp(rbuf, &wbuf[192], 16)==0, "read-ahead after queued write");
+	file.fReadAhead(NULL, 0);
+
+	// The size is committed after the last of the data, and fSync() finishes the queue
+	_check(file.fCreate("grow", 256) && file.fWriteAsync(&write, 0, wbuf, 256), "queue grow");
+	vol.Poll();
+	_check(write.state==SFFS_REQ_ACTIVE && file.fSize()==0, "size after data");
+	file.fSync();
+	_check(write.state==SFFS_REQ_DONE && file.fSize()==256, "fSync finishes queue");
+	_check(vol.restart() && file.fOpen("grow") && file.fSize()==256, "async size kept");
+}
+
+// Files a to e (a at the top of the FRAM) are deleted, their space reused and compacted
+static void
+bench_delete(eSimBus bus, uint32 framSize)
+{
+	static const uint32 sizes[5] = { 1024, 2048, 1024, 2048, 512 };
+	static uint8 wbuf[2048];
+	static uint8 rbuf[2048];
+	char name[2] = { 'a', 0 };
+	SFFS_Volume_Sim vol;
+	SFFS_File file(vol);
+	SFFS_File keep(vol);
+
+	vol.begin(bus, framSize);
+	vol.VolumeCreate("Bench");
+	cMeasure m(vol.Driver().Fram());
+	for (uint i=0; i<5; i++, name[0]++)
+	{
+		_fill(wbuf, sizes[i], (uint8)i);
+		_check(file.fCreate(name, sizes[i]) && file.fWrite(wbuf, sizes[i])==sizes[i], "delete setup");
+	}
+	uint32 free = vol.VolumeFree();
+	m.Start();
+	_check(file.fDelete("b"), "fDelete");
+	m.Stop("fDelete");
+	_check(vol.VolumeFree()==free+2048 && !file.fOpen("b") && !file.fOpen(1), "fDelete frees");
+	m.Start();
+	_check(file.fCreate("f", 512), "fCreate f");
+	m.Stop("fCreate into a free extent");
+	_check(vol.VolumeFree()==free+2048-512-vol.FileHeadSize(), "free extent reused");
+	_fill(wbuf, 512, 5);
+	file.fWrite(wbuf, 512);
+	// e is the lowest, so its space goes straight back
+	_check(file.fDelete("d") && file.fDelete("e"), "fDelete d e");
+
+	// c moves up into what is left of b, an open handle follows it
+	_check(keep.fOpen("c"), "open c");
+	uint calls = 0;
+	m.Start();
+	while (vol.Compact() && calls < 100)
+		calls++;
+	m.Stop("Compact() call, 256 bytes", calls);
+	// d given back, c copied in four, then c's old space and the rest of b given back
+	_check(calls==7, "compact calls");
+	_fill(wbuf, 1024, 2);
+	_check(keep.fReadAt(0, rbuf, 1024)==1024 && memcmp(rbuf, wbuf, 1024)==0, "moved file handle");
+	_check(vol.VolumeFree()==framSize-vol.FileMemStart()-((vol.FileCount()+1)*vol.FileHeadSize())-2560, "compacted free");
+
+	// A header left by a deleted file is used before the table grows
+	uint count = vol.FileCount();
+	_check(file.fCreate("g", 1500) && vol.FileCount()==count, "empty header reused");
+	vol.restart();
+	name[0] = 'a';
+	for (uint i=0; i<6; i++, name[0]++)
+	{
+		bool bLive = (name[0]=='a' || name[0]=='c' || name[0]=='f');
+		uint32 size = (name[0]=='f') ? 512 : sizes[i];
+		_fill(wbuf, size, (uint8)i);
+		_check(file.fOpen(name)==bLive, "deleted files stay deleted");
+		if (bLive)
+			_check(file.fReadAt(0, rbuf, size)==size && memcmp(rbuf, wbuf, size)==0, "data after compact");
+	}
+
+	// A power cut while a free extent is split: a's space has gone to h but is still marked
+	_check(file.fDelete("a") && file.fCreate("h", 256), "split a");
+	free = vol.VolumeFree();
+	vol.VolumeSync();
+	uint8* pMem = vol.Driver().Fram().Mem();
+	SFFS_FILE_HEAD* pHole = (SFFS_FILE_HEAD*)(pMem+vol.FileMemStart());
+	for (uint i=0; i<vol.FileCount(); i++)
+	{
+		if (strcmp(((SFFS_FILE_HEAD*)(pMem+vol.FileMemStart()+(i*vol.FileHeadSize())))->name, "h")==0)
+			pHole->dataWrittenSize = i+1;
+	}
+	pHole->dataMaxSize += 256;
+	vol.restart();
+	_check(vol.VolumeFree()==free && pHole->dataMaxSize==1024-256 && pHole->dataWrittenSize==0, "split recovered");
+}
+
+// A current volume on SPI and a version 2 one on I2C mounted together, each
+// keeps its own file header layout
+static void
+bench_volumes()
+{
+	SFFS_Volume_Sim spiVol;
+	SFFS_Volume_Sim i2cVol;
+	SFFS_VolumeManager volumes;
+	char data[4];
+
+	spiVol.begin(SIM_BUS_SPI, 32768);
+	spiVol.VolumeCreate("Main");
+	i2cVol.begin(SIM_BUS_I2C, 32768);
+	_v2Image(i2cVol.Driver().Fram().Mem());
+	i2cVol.restart();
+	_check(volumes.Mount(spiVol) && volumes.Mount(i2cVol) && volumes.Count()==2, "mount both");
+
+	SFFS_File spiFile(*volumes.Find("Main"));
+	SFFS_File i2cFile(*volumes.Find("Two"));
+	_check(spiFile.fCreate("x", 64) && i2cFile.fCreate("y", 64), "create on both");
+	_check(spiFile.fCreate("z", 64) && i2cFile.fOpen("b"), "create and open");
+	_check(i2cFile.fReadAt(0, data, 4)==4 && memcmp(data, "bbb", 4)==0, "read v2 beside v3");
+	_check(volumes.FindFile("y")==&i2cVol && volumes.FindFile("z")==&spiVol && volumes.FindFile("q")==NULL, "find file");
+
+	cMeasure spi(spiVol.Driver().Fram());
+	cMeasure i2c(i2cVol.Driver().Fram());
+	_check(spiFile.fOpen("x") && spiFile.fWrite((void*)"sss", 4)==4, "write SPI");
+	spi.Stop("fOpen+fWrite 4, SPI volume");
+	_check(i2cFile.fOpen("y") && i2cFile.fWrite((void*)"iii", 4)==4, "write I2C");
+	i2c.Stop("fOpen+fWrite 4, I2C volume");
+	volumes.Sync();
+
+	spiVol.restart();
+	i2cVol.restart();
+	_check(spiFile.fOpen("x") && spiFile.fReadAt(0, data, 4)==4 && memcmp(data, "sss", 4)==0, "reopen SPI");
+	_check(i2cFile.fOpen("y") && i2cFile.fReadAt(0, data, 4)==4 && memcmp(data, "iii", 4)==0, "reopen I2C");
+	_check(spiVol.FileCount()==2 && i2cVol.FileCount()==3, "file counts");
+	volumes.Unmount(spiVol);
+	_check(volumes.Count()==1 && volumes.Volume(0)==&i2cVol && volumes.Find("Main")==NULL, "unmount");
+}
+
+// Time is charged per FRAM, so devices on their own buses would take the longest of them
+static void
+_stripedStop(const char* label, cIO_DRV_Sim* pDrv, uint8 devices, sSimStats* pStart)
+{
+	uint32 txns = 0;
+	uint32 busBytes = 0;
+	double serial = 0;
+	double parallel = 0;
+
+	for (uint8 i=0; i<devices; i++)
+	{
+		sSimStats& end = pDrv[i].Fram().Stats();
+		txns += end.transactions-pStart[i].transactions;
+		busBytes += end.busBytes-pStart[i].busBytes;
+		serial += end.us-pStart[i].us;
+		if (end.us-pStart[i].us > parallel)
+			parallel = end.us-pStart[i].us;
+		pStart[i] = end;
+	}
+	printf("  %-32s %8lu %10lu %12.1f %12.1f\n", label, (unsigned long)txns, (unsigned long)busBytes, serial, parallel);
+}
+
+// 8KB file transfers on a volume striped across 1 to 4 SPI FRAMs of 32KB
+static void
+bench_striped(uint8 devices)
+{
+	static uint8 wbuf[BENCH_DATA_FILE];
+	static uint8 rbuf[BENCH_DATA_FILE];
+	cIO_DRV_Sim drv[IO_STRIPED_MAX_DEVICES];
+	cIO_DRV* pDevices[IO_STRIPED_MAX_DEVICES];
+	sSimStats start[IO_STRIPED_MAX_DEVICES];
+	SFFS_Volume_Striped vol;
+	SFFS_File file(vol);
+	char label[48];
+
+	for (uint8 i=0; i<devices; i++)
+	{
+		drv[i].Init(SIM_BUS_SPI, 32768, SIM_SPI_CS_PIN+i);
+		pDevices[i] = &drv[i];
+	}
+	_check(vol.begin(pDevices, devices) && vol.VolumeCreate("Striped") && vol.VolumeSize()==32768UL*devices, "striped size");
+	_check(file.fCreate("data", BENCH_DATA_FILE), "striped fCreate");
+	_fill(wbuf, sizeof(wbuf), devices);
+
+	for (uint8 i=0; i<devices; i++)
+		start[i] = drv[i].Fram().Stats();
+	_check(file.fWriteAt(0, wbuf, sizeof(wbuf))==sizeof(wbuf), "striped write");
+	snprintf(label, sizeof(label), "fWrite 8192, %u device%s", devices, (devices>1) ? "s" : "");
+	_stripedStop(label, drv, devices, start);
+	_check(file.fReadAt(0, rbuf, sizeof(rbuf))==sizeof(rbuf), "striped read");
+	snprintf(label, sizeof(label), "fRead 8192, %u device%s", devices, (devices>1) ? "s" : "");
+	_stripedStop(label, drv, devices, start);
+	_check(memcmp(rbuf, wbuf, sizeof(rbuf))==0, "striped data");
+
+	// The stripes are dealt out in turn, 256 bytes each
+	uint32 dataOffset = (32768UL*devices)-BENCH_DATA_FILE;
+	uint32 stripe = dataOffset/256;
+	_check(memcmp(drv[stripe%devices].Fram().Mem()+((stripe/devices)*256), wbuf, 256)==0, "striped layout");
+	_check(vol.begin(pDevices, devices) && vol.VolumeName()!=NULL && file.fOpen("data"), "striped mount");
+
+	// Parts that can not report their size are probed, which needs a power of two count
+	cIO_DRV_Striped probed;
+	for (uint8 i=0; i<devices; i++)
+		drv[i].Init(SIM_BUS_SPI, 32768, SIM_SPI_CS_PIN+i, false);
+	_check(probed.Init(pDevices, devices)==((devices & (devices-1))==0), "striped probe count");
+	for (uint8 i=0; i<devices; i++)
+		cFRAM_Sim::AttachSPI(SIM_SPI_CS_PIN+i, NULL);
+}
+
+// Driver transfers across the 64KB page boundary of a 1Mbit I2C part
+static void
+bench_i2c_page()
+{
+	static uint8 wbuf[4096];
+	static uint8 rbuf[4096];
+	const uint32 addr = 0x10000-2048;
+	SFFS_Volume_Sim vol;
+
+	vol.begin(SIM_BUS_I2C, 131072);
+	cIO_DRV& drv = vol.Driver();
+	uint8* pMem = vol.Driver().Fram().Mem();
+	cMeasure m(vol.Driver().Fram());
+
+	_fill(wbuf, sizeof(wbuf), 7);
+	m.Start();
+	_check(drv.Write(addr, wbuf, sizeof(wbuf))==sizeof(wbuf), "page write");
+	m.Stop("Write 4096 across 64KB page");
+	_check(memcmp(pMem+addr, wbuf, sizeof(wbuf))==0, "page write data");
+	m.Start();
+	_check(drv.Read(addr, rbuf, sizeof(rbuf))==sizeof(rbuf), "page read");
+	m.Stop("Read 4096 across 64KB page");
+	_check(memcmp(rbuf, wbuf, sizeof(rbuf))==0, "page read data");
+}
+
+// A sensor logger appending 12 byte samples, as plain appends and as log records
+static void
+bench_log(eSimBus bus, uint32 framSize)
+{
+	uint8 rec[12];
+	SFFS_Volume_Sim vol;
+	SFFS_File file(vol);
+	SFFS_File reader(vol);
+
+	vol.begin(bus, framSize);
+	vol.VolumeCreate("Bench");
+	cMeasure m(vol.Driver().Fram());
+
+	_check(file.fCreate("plain", 4096), "fCreate plain");
+	m.Start();
+	for (uint i=0; i<100; i++)
+		file.fWrite(rec, sizeof(rec));
+	m.Stop("fWrite 12 (plain append)", 100);
+
+	_check(file.fCreate("log", 4096, SFFS_FILE_LOG, 256), "fCreate log");
+	m.Start();
+	for (uint i=0; i<100; i++)
+	{
+		_fill(rec, sizeof(rec), (uint8)i);
+		file.fAppend(rec, sizeof(rec));
+	}
+	file.fSync();
+	m.Stop("fAppend 12 (log, commit/256B)", 100);
+	_check(file.fSize()==100*(sizeof(rec)+sizeof(SFFS_LOG_FRAME)), "log size");
+
+	// Power is lost with the last few records past the committed size
+	for (uint i=100; i<120; i++)
+	{
+		_fill(rec, sizeof(rec), (uint8)i);
+		file.fAppend(rec, sizeof(rec));
+	}
+	vol.restart();
+	m.Start();
+	_check(reader.fOpen("log") && reader.fSize()==120*(sizeof(rec)+sizeof(SFFS_LOG_FRAME)), "log recovery");
+	m.Stop("fOpen log after power loss");
+
+	uint8 expect[12];
+	uint count = 0;
+	bool bOk = true;
+	reader.fSeek(0);
+	while (reader.fReadNext(rec, sizeof(rec))==sizeof(rec))
+	{
+		_fill(expect, sizeof(expect), (uint8)count++);
+		bOk = bOk && memcmp(rec, expect, sizeof(rec))==0;
+	}
+	_check(bOk && count==120, "log replay");
+}
+
+// Telemetry kept as the newest 64 records of 16 bytes, as a ring file and as a plain
+// file with its head offset in a second file, the way it had to be done before
+static void
+bench_ring(eSimBus bus, uint32 framSize)
+{
+	uint8 rec[16];
+	uint8 recs[10*16];
+	uint8 expect[16];
+	SFFS_Volume_Sim vol;
+	SFFS_File file(vol);
+	SFFS_File meta(vol);
+
+	vol.begin(bus, framSize);
+	vol.VolumeCreate("Bench");
+	cMeasure m(vol.Driver().Fram());
+
+	_check(file.fCreate("data", 64*sizeof(rec)) && meta.fCreate("head", sizeof(uint32)), "fCreate manual ring");
+	uint32 head = 0;
+	meta.fWrite(&head, sizeof(head));
+	_fill(rec, sizeof(rec), 0);
+	for (uint i=0; i<64; i++)
+		file.fWrite(rec, sizeof(rec));
+	m.Start();
+	for (uint i=0; i<100; i++)
+	{
+		file.fWriteAt(head, rec, sizeof(rec));
+		head = (head+sizeof(rec)) % (64*sizeof(rec));
+		meta.fWriteAt(0, &head, sizeof(head));
+	}
+	m.Stop("fWriteAt record + head (manual)", 100);
+
+	_check(!file.fCreate("logring", 64*sizeof(rec), SFFS_FILE_LOG | SFFS_FILE_RING, sizeof(rec)), "log ring refused");
+	_check(!file.fCreate("typo", 64, 0x0100), "unknown flag refused");
+	_check(file.fCreate("ring", 64*sizeof(rec), SFFS_FILE_RING, sizeof(rec)), "fCreate ring");
+	m.Start();
+	for (uint i=0; i<200; i++)
+	{
+		_fill(rec, sizeof(rec), (uint8)i);
+		file.fAppend(rec, sizeof(rec));
+	}
+	m.Stop("fAppend 16 (ring)", 200);
+	_check(file.fSize()==64*sizeof(rec), "ring full");
+
+	vol.restart();
+	m.Start();
+	_check(file.fOpen("ring") && file.fReadLatest(recs, 10)==10, "fReadLatest");
+	m.Stop("fOpen + fReadLatest 10 records");
+	bool bOk = true;
+	for (uint i=0; i<10; i++)
+	{
+		_fill(expect, sizeof(expect), (uint8)(190+i));
+		bOk = bOk && memcmp(&recs[i*sizeof(rec)], expect, sizeof(expect))==0;
+	}
+	_check(bOk, "fReadLatest data");
+
+	m.Start();
+	_check(file.fReadOldest(rec)==sizeof(rec), "fReadOldest");
+	m.Stop("fReadOldest");
+	_fill(expect, sizeof(expect), 200-64);
+	_check(memcmp(rec, expect, sizeof(rec))==0 && file.fSize()==63*sizeof(rec), "fReadOldest data");
+	_fill(expect, sizeof(expect), 200-63);
+	_check(file.fReadAt(0, rec, sizeof(rec))==sizeof(rec) && memcmp(rec, expect, sizeof(rec))==0, "ring fReadAt");
+}
+
+static void
+bench_files(eSimBus bus, uint32 framSize)
+{
+	static uint8 wbuf[4096];
+	static uint8 rbuf[4096];
+	static const uint32 sizes[] = { 16, 256, 4096 };
+	char name[SFFS_FILE_NAME_BUFFER_LEN];
+	char label[48];
+	SFFS_Volume_Sim vol;
+	SFFS_File file(vol);
+
+	vol.begin(bus, framSize);
+	cMeasure m(vol.Driver().Fram());
+
+	_check(vol.VolumeCreate("Bench"), "VolumeCreate");
+	m.Stop("VolumeCreate");
+
+	for (uint i=0; i<BENCH_FILES; i++)
+	{
+		snprintf(name, sizeof(name), "file%02u", i);
+		m.Start();
+		_check(file.fCreate(name, BENCH_SMALL_FILE), "fCreate");
+		if (i==0)
+			m.Stop("fCreate (first file)");
+		else if (i==BENCH_FILES-1)
+		{
+			snprintf(label, sizeof(label), "fCreate (file #%u)", BENCH_FILES);
+			m.Stop(label);
+		}
+	}
+	m.Start();
+	_check(file.fCreate("data", BENCH_DATA_FILE), "fCreate data");
+	m.Stop("fCreate (data file)");
+
+	m.Start();
+	_check(file.fOpen("file00"), "fOpen first");
+	m.Stop("fOpen(name) first file");
+	snprintf(name, sizeof(name), "file%02u", BENCH_FILES-1);
+	m.Start();
+	_check(file.fOpen(name), "fOpen last");
+	snprintf(label, sizeof(label), "fOpen(name) file #%u", BENCH_FILES);
+	m.Stop(label);
+	m.Start();
+	_check(file.fOpen((uint)BENCH_FILES), "fOpen index");
+	m.Stop("fOpen(index)");
+
+	// Appends grow the file, reads come back from the start
+	uint32 offset = 0;
+	for (uint i=0; i<sizeof(sizes)/sizeof(sizes[0]); i++)
+	{
+		_fill(wbuf, sizes[i], (uint8)i);
+		m.Start();
+		_check(file.fWrite(wbuf, sizes[i])==sizes[i], "fWrite");
+		snprintf(label, sizeof(label), "fWrite %lu (append)", (unsigned long)sizes[i]);
+		m.Stop(label);
+		m.Start();
+		_check(file.fReadAt(offset, rbuf, sizes[i])==sizes[i], "fReadAt");
+		snprintf(label, sizeof(label), "fReadAt %lu", (unsigned long)sizes[i]);
+		m.Stop(label);
+		_check(memcmp(wbuf, rbuf, sizes[i])==0, "read back");
+		// The read leaves the file pointer at the end, ready for the next append
+		offset += sizes[i];
+	}
+	for (uint i=0; i<sizeof(sizes)/sizeof(sizes[0]); i++)
+	{
+		_fill(wbuf, sizes[i], (uint8)(i+100));
+		m.Start();
+		_check(file.fWriteAt(0, wbuf, sizes[i])==sizes[i], "fWriteAt");
+		snprintf(label, sizeof(label), "fWriteAt %lu (overwrite)", (unsigned long)sizes[i]);
+		m.Stop(label);
+	}
+	m.Start();
+	for (uint i=0; i<100; i++)
+		file.fWriteAt(64+i, wbuf, 4);
+	file.fSync();
+	m.Stop("fWriteAt 4 (field update), fSync", 100);
+	// Each byte was last written as the first of a 4 byte field
+	uint8* pData = vol.Driver().Fram().Mem() + framSize - (BENCH_FILES*BENCH_SMALL_FILE) - BENCH_DATA_FILE;
+	bool bSynced = true;
+	for (uint i=0; i<100; i++)
+		bSynced = bSynced && (pData[64+i]==wbuf[0]);
+	_check(bSynced, "fSync");
+	m.Start();
+	for (uint i=0; i<100; i++)
+		file.fReadAt(i*12, rbuf, 12);
+	m.Stop("fReadAt 12 (record replay)", 100);
+	static uint8 ahead[256];
+	file.fReadAhead(ahead, sizeof(ahead));
+	file.fSeek(0);
+	m.Start();
+	for (uint i=0; i<100; i++)
+		file.fRead(&wbuf[i*12], 12);
+	m.Stop("fRead 12, 256 byte read-ahead", 100);
+	file.fReadAhead(NULL, 0);
+	_check(file.fReadAt(0, rbuf, 1200)==1200 && memcmp(wbuf, rbuf, 1200)==0, "read-ahead");
+
+	// A structure saved a field at a time, to scattered and then to adjacent offsets
+	uint32 fields[4] = { 0x11111111, 0x22222222, 0x33333333, 0x44444444 };
+	uint32 check[4];
+	sIO_VEC vec[4];
+	for (uint i=0; i<4; i++)
+	{
+		vec[i].offset = 1024+(i*100);
+		vec[i].pBuf = &fields[i];
+		vec[i].count = sizeof(fields[i]);
+	}
+	m.Start();
+	for (uint i=0; i<4; i++)
+		file.fWriteAt(vec[i].offset, vec[i].pBuf, vec[i].count);
+	m.Stop("fWriteAt x4 (scattered fields)");
+	m.Start();
+	_check(file.fWriteV(vec, 4)==sizeof(fields), "fWriteV");
+	m.Stop("fWriteV 4 scattered fields");
+	for (uint i=0; i<4; i++)
+		vec[i].offset = 1224+(i*sizeof(fields[i]));
+	m.Start();
+	_check(file.fWriteV(vec, 4)==sizeof(fields), "fWriteV");
+	m.Stop("fWriteV 4 adjacent fields");
+	for (uint i=0; i<4; i++)
+		vec[i].pBuf = &check[i];
+	m.Start();
+	_check(file.fReadV(vec, 4)==sizeof(check) && memcmp(fields, check, sizeof(check))==0, "fReadV");
+	m.Stop("fReadV 4 adjacent fields");
+	_check(file.fReadAt(1124, check, 4)==4 && check[0]==fields[1], "fWriteV scattered");
+
+	// Adjacent ranges longer than a Wire buffer, so the run goes out and comes back in blocks
+	uint8 runOut[4][20];
+	uint8 runIn[4][20];
+	for (uint i=0; i<4; i++)
+	{
+		_fill(runOut[i], sizeof(runOut[i]), (uint8)(40+i));
+		vec[i].offset = 1300+(i*sizeof(runOut[i]));
+		vec[i].pBuf = runOut[i];
+		vec[i].count = sizeof(runOut[i]);
+	}
+	_check(file.fWriteV(vec, 4)==sizeof(runOut), "fWriteV long run");
+	for (uint i=0; i<4; i++)
+		vec[i].pBuf = runIn[i];
+	memset(runIn, 0, sizeof(runIn));
+	_check(file.fReadV(vec, 4)==sizeof(runIn) && memcmp(runOut, runIn, sizeof(runIn))==0, "fReadV long run");
+	memset(runIn, 0, sizeof(runIn));
+	_check(file.fReadAt(1300, runIn, sizeof(runIn))==sizeof(runIn) && memcmp(runOut, runIn, sizeof(runIn))==0, "fWriteV long run data");
+
+	m.Start();
+	_check(vol.restart() && vol.FileCount()==BENCH_FILES+1, "restart");
+	m.Stop("init() warm restart");
+
+	_check(file.fOpen("data") && file.fSize()==offset, "reopen size");
+	_fill(wbuf, 4096, 102);
+	_check(file.fReadAt(0, rbuf, 4096)==4096 && memcmp(wbuf, rbuf, 64)==0, "reopen data");
+#if SFFS_CACHE_LINES > 0
+	SFFS_CACHE_STATS& stats = vol.CacheStats();
+	uint32 lookups = stats.readHits+stats.readMisses+stats.writeHits+stats.writeMisses;
+	printf("  cache: %.1f%% line hits, %lu bytes asked for, %lu moved by the driver in %lu calls\n",
+		(lookups) ? (100.0*(stats.readHits+stats.writeHits))/lookups : 0.0,
+		(unsigned long)(stats.bytesRead+stats.bytesWritten),
+		(unsigned long)(stats.driverRead+stats.driverWritten),
+		(unsigned long)stats.driverCalls);
+
+	// Flushed through the plain stream type, as a caller holding Stream() would
+	SFFS_Stream& ios = vol.Stream();
+	uint32 lastAddr = vol.VolumeSize()-1;
+	uint8 last, flipped;
+	ios.Read(lastAddr, &last, 1);
+	flipped = last ^ 0xFF;
+	ios.Write(lastAddr, &flipped, 1);
+	ios.Flush();
+	_check(vol.Driver().Fram().Mem()[lastAddr]==flipped, "Stream().Flush()");
+	ios.Write(lastAddr, &last, 1);
+	ios.Flush();
+#endif
+}
+
+// Host CPU time per 4 byte driver read, through a cIO_DRV& or the driver's own type
+template <class DRV>
+static double
+_callNs(DRV& drv, uint32 calls)
+{
+	struct timespec start, end;
+	uint8 buf[4];
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (uint32 i=0; i<calls; i++)
+		drv.Read((i*4) & 0x3FFF, buf, sizeof(buf));
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return ((end.tv_sec-start.tv_sec)*1e9 + (end.tv_nsec-start.tv_nsec))/calls;
+}
+
+static void
+bench_binding()
+{
+	const uint32 calls = 200000;
+	cFRAM_Sim fram;
+	SFFS_Volume_SPI vol;
+	SFFS_VolumeT< cIO_DRV_SPI_T<2> > volT;
+	cIO_DRV& drv = vol.Driver();
+	char label[48];
+
+	fram.Create(32768, 2, true);
+	cFRAM_Sim::AttachSPI(SIM_SPI_CS_PIN, &fram);
+	_check(vol.begin(SIM_SPI_CS_PIN) && vol.VolumeCreate("Bench"), "SFFS_Volume_SPI");
+	_check(volT.begin(SIM_SPI_CS_PIN) && volT.VolumeName()!=NULL && volT.VolumeSize()==32768, "SFFS_VolumeT fixed width");
+
+	// The bus cost is the same, only the call differs
+	cMeasure m(fram);
+	snprintf(label, sizeof(label), "Read 4, cIO_DRV& (%.0f host ns)", _callNs(drv, calls));
+	m.Stop(label, calls);
+	snprintf(label, sizeof(label), "Read 4, _SPI_T<2> (%.0f host ns)", _callNs(volT.Driver(), calls));
+	m.Stop(label, calls);
+	cFRAM_Sim::AttachSPI(SIM_SPI_CS_PIN, NULL);
+}
+
+// A 2KB state struct updated 100 times, a counter and one setting each time, written
+// whole with fWriteAt() and by SFFS_Persistent
+typedef struct {
+	uint32 updates;
+	int8 settings[2044];
+}BENCH_STATE;
+
+static void
+bench_persistent(eSimBus bus, uint32 framSize)
+{
+	static BENCH_STATE state;
+	SFFS_Volume_Sim vol;
+	SFFS_File file(vol);
+	SFFS_Persistent<BENCH_STATE> persist(file);
+
+	vol.begin(bus, framSize);
+	vol.VolumeCreate("Bench");
+	cMeasure m(vol.Driver().Fram());
+
+	memset(&state, 0, sizeof(state));
+	_check(file.fCreate("whole", sizeof(state)), "fCreate whole");
+	file.fWriteAt(0, &state, sizeof(state));
+	sSimStats start = vol.Driver().Fram().Stats();
+	for (uint i=0; i<100; i++)
+	{
+		state.updates++;
+		state.settings[(i*97) % sizeof(state.settings)] = (int8)i;
+		file.fWriteAt(0, &state, sizeof(state));
+	}
+	uint32 wholeBytes = vol.Driver().Fram().Stats().busBytes-start.busBytes;
+	m.Stop("fWriteAt whole 2KB struct", 100);
+
+	_check(file.fCreate("state", sizeof(state)), "fCreate state");
+	persist->updates = 1;
+	_check(persist.sync()==0 && file.fSize()==0, "SFFS_Persistent sync before load");
+	persist->updates = 0;
+	_check(!persist.load(), "SFFS_Persistent new file");
+	start = vol.Driver().Fram().Stats();
+	m.Start();
+	for (uint i=0; i<100; i++)
+	{
+		persist->updates++;
+		persist->settings[(i*97) % sizeof(state.settings)] = (int8)i;
+		persist.sync();
+	}
+	uint32 diffBytes = vol.Driver().Fram().Stats().busBytes-start.busBytes;
+	m.Stop("SFFS_Persistent sync()", 100);
+	_check(diffBytes*10 < wholeBytes, "SFFS_Persistent saves 90% of the bus bytes");
+
+	SFFS_Persistent<BENCH_STATE> check(file);
+	_check(file.fOpen("state") && check.load() && memcmp(&check.Data(), &state, sizeof(state))==0, "SFFS_Persistent reload");
+}
+
+// A 256 byte record updated 100 times then read back at boot, as an atomic file and as
+// the two copies compared on boot it replaces. Then writes cut short by a power loss.
+static void
+bench_atomic(eSimBus bus, uint32 framSize)
+{
+	uint8 rec[256];
+	uint8 copy[256];
+	SFFS_Volume_Sim vol;
+	SFFS_File file(vol);
+	SFFS_File fileB(vol);
+
+	vol.begin(bus, framSize);
+	vol.VolumeCreate("Bench");
+	cMeasure m(vol.Driver().Fram());
+
+	_check(file.fCreate("copyA", sizeof(rec)) && fileB.fCreate("copyB", sizeof(rec)), "fCreate copies");
+	m.Start();
+	for (uint i=0; i<100; i++)
+	{
+		_fill(rec, sizeof(rec), (uint8)i);
+		file.fWriteAt(0, rec, sizeof(rec));
+		fileB.fWriteAt(0, rec, sizeof(rec));
+	}
+	m.Stop("fWriteAt 256 to two copies", 100);
+	vol.restart();
+	m.Start();
+	_check(file.fOpen("copyA") && fileB.fOpen("copyB"), "fOpen copies");
+	file.fReadAt(0, rec, sizeof(rec));
+	fileB.fReadAt(0, copy, sizeof(copy));
+	m.Stop("boot, fOpen+fRead two copies");
+	_check(memcmp(rec, copy, sizeof(rec))==0, "copies match");
+
+	_check(file.fCreate("atomic", sizeof(rec), SFFS_FILE_ATOMIC) && file.fSizeMax()==sizeof(rec) && file.fSize()==0, "fCreate atomic");
+	m.Start();
+	for (uint i=0; i<100; i++)
+	{
+		_fill(rec, sizeof(rec), (uint8)i);
+		file.fWriteAt(0, rec, sizeof(rec));
+	}
+	m.Stop("fWriteAt 256 atomic", 100);
+	vol.restart();
+	m.Start();
+	_check(file.fOpen("atomic") && file.fSize()==sizeof(rec), "fOpen atomic");
+	m.Stop("boot, fOpen atomic");
+	m.Start();
+	file.fReadAt(0, copy, sizeof(copy));
+	m.Stop("boot, fRead atomic");
+	_check(memcmp(rec, copy, sizeof(rec))==0, "atomic data");
+
+	// Power lost part way through the next record's data, then part way through its slot head
+	SFFS_FILE_HEAD head;
+	SFFS_ATOMIC_SLOT slot = { sizeof(rec), 101, 0 };
+	vol.Stream().Read(vol.FileMemStart()+file.index()*vol.FileHeadSize(), &head, sizeof(head));
+	uint32 next = head.dataOffset+((slot.seq & 1) ? head.dataMaxSize/2 : 0);
+	memset(copy, 0xEE, sizeof(copy));
+	vol.Stream().Write(next+sizeof(slot), copy, sizeof(copy)/2);
+	_check(file.fOpen("atomic") && file.fReadAt(0, copy, sizeof(copy))==sizeof(copy) && memcmp(rec, copy, sizeof(rec))==0, "atomic torn data");
+	vol.Stream().Write(next, &slot, offsetof(SFFS_ATOMIC_SLOT, check));
+	_check(file.fOpen("atomic") && file.fReadAt(0, copy, sizeof(copy))==sizeof(copy) && memcmp(rec, copy, sizeof(rec))==0, "atomic torn head");
+
+	// The next write goes over the torn slot, and a shorter record changes the size
+	_fill(rec, 100, 0x42);
+	_check(file.fWriteAt(0, rec, 100)==100 && file.fOpen("atomic") && file.fSize()==100, "atomic rewrite");
+	_check(file.fReadAt(0, copy, 100)==100 && memcmp(rec, copy, 100)==0, "atomic rewrite data");
+	_check(file.fWriteAt(0, rec, sizeof(rec)+1)==0, "atomic too big");
+}
+
+// 200 calibration records of 16 bytes, by hand at index*16 with fReadAt() and fWriteAt(),
+// then as a record file
+static void
+bench_records(eSimBus bus, uint32 framSize)
+{
+	uint8 rec[16];
+	static uint8 recs[200*16];
+	static uint8 copy[200*16];
+	SFFS_Volume_Sim vol;
+	SFFS_File file(vol);
+
+	vol.begin(bus, framSize);
+	vol.VolumeCreate("Bench");
+	cMeasure m(vol.Driver().Fram());
+	for (uint i=0; i<200; i++)
+		_fill(&recs[i*sizeof(rec)], sizeof(rec), (uint8)i);
+
+	_check(file.fCreate("manual", sizeof(recs)), "fCreate manual records");
+	m.Start();
+	for (uint i=0; i<200; i++)
+		file.fWrite(&recs[i*sizeof(rec)], sizeof(rec));
+	m.Stop("fWrite 16 to the end (manual)", 200);
+	for (uint i=0; i<200; i++)
+		file.fReadAt(((i*37)%200)*sizeof(rec), rec, sizeof(rec));
+	m.Stop("fReadAt index*16 (manual)", 200);
+	for (uint i=0; i<200; i++)
+		file.fReadAt(i*sizeof(rec), &copy[i*sizeof(rec)], sizeof(rec));
+	m.Stop("200 records, fReadAt each", 1);
+
+	_check(file.fCreate("records", sizeof(recs), SFFS_FILE_RECORD, sizeof(rec)) && file.fRecordMax()==200, "fCreate records");
+	m.Start();
+	for (uint i=0; i<200; i++)
+		file.fAppendRecord(&recs[i*sizeof(rec)]);
+	m.Stop("fAppendRecord 16", 200);
+	_check(file.fRecordCount()==200 && !file.fAppendRecord(rec), "records full");
+	bool bOk = true;
+	for (uint i=0; i<200; i++)
+	{
+		uint32 index = (i*37)%200;
+		bOk &= file.fReadRecord(index, rec) && memcmp(rec, &recs[index*sizeof(rec)], sizeof(rec))==0;
+	}
+	m.Stop("fReadRecord", 200);
+	_check(bOk, "fReadRecord data");
+	_fill(&recs[50*sizeof(rec)], sizeof(rec), 0xA5);
+	m.Start();
+	_check(file.fWriteRecord(50, &recs[50*sizeof(rec)]), "fWriteRecord");
+	m.Stop("fWriteRecord 16");
+
+	vol.restart();
+	memset(copy, 0, sizeof(copy));
+	m.Start();
+	_check(file.fOpen("records") && file.fReadRecords(0, 200, copy)==200, "fReadRecords");
+	m.Stop("boot, fOpen + fReadRecords 200");
+	_check(memcmp(recs, copy, sizeof(recs))==0, "fReadRecords data");
+	_check(file.fReadRecords(190, 20, copy)==10 && memcmp(&recs[190*sizeof(rec)], copy, 10*sizeof(rec))==0, "fReadRecords at the end");
+	_check(!file.fReadRecord(200, rec) && !file.fWriteRecord(201, rec), "record bounds");
+	_check(!file.fCreate("bad", 8, SFFS_FILE_RECORD, 16), "record size bigger than the file");
+}
+
+// 40 settings of 16 bytes, a file each and then in one SFFS_KV file, looked up, changed
+// and looked for under names that are not there, with and without the RAM key index
+static void
+bench_kv(eSimBus bus, uint32 framSize)
+{
+	uint8 value[16];
+	uint8 got[16];
+	uint8 tags[64];
+	char name[16];
+	SFFS_Volume_Sim vol;
+	SFFS_File file(vol);
+	SFFS_KV kv(file);
+	uint16 len;
+	bool bOk = true;
+
+	vol.begin(bus, framSize);
+	vol.VolumeCreate("Bench");
+	cMeasure m(vol.Driver().Fram());
+
+	uint32 free = vol.VolumeFree();
+	m.Start();
+	for (uint i=0; i<40; i++)
+	{
+		snprintf(name, sizeof(name), "set%02u", i);
+		_fill(value, sizeof(value), (uint8)i);
+		file.fCreate(name, sizeof(value));
+		file.fWrite(value, sizeof(value));
+	}
+	m.Stop("fCreate+fWrite (file per value)", 40);
+	uint32 usedFiles = free-vol.VolumeFree();
+	for (uint i=0; i<40; i++)
+	{
+		snprintf(name, sizeof(name), "set%02u", (i*7)%40);
+		bOk &= file.fOpen(name) && file.fReadAt(0, got, sizeof(got))==sizeof(got);
+	}
+	m.Stop("fOpen+fRead (file per value)", 40);
+	for (uint i=0; i<40; i++)
+	{
+		snprintf(name, sizeof(name), "set%02u", (i*7)%40);
+		_fill(value, sizeof(value), (uint8)(i+100));
+		bOk &= file.fOpen(name) && file.fWriteAt(0, value, sizeof(value))==sizeof(value);
+	}
+	m.Stop("fOpen+fWriteAt (file per value)", 40);
+	for (uint i=0; i<40; i++)
+	{
+		snprintf(name, sizeof(name), "none%02u", i);
+		bOk &= !file.fOpen(name);
+	}
+	m.Stop("fOpen miss (file per value)", 40);
+	_check(bOk, "file per value");
+
+	free = vol.VolumeFree();
+	m.Start();
+	_check(kv.create("settings", 64, sizeof(value)), "SFFS_KV create");
+	m.Stop("SFFS_KV create, 64 x 16");
+	uint32 usedKv = free-vol.VolumeFree();
+	for (uint pass=0; pass<2; pass++)
+	{
+		const char* how = (pass) ? ", key index" : "";
+		char label[48];
+		if (pass)
+		{
+			_check(kv.keyIndex(tags, sizeof(tags)), "SFFS_KV keyIndex");
+			snprintf(label, sizeof(label), "keyIndex 64");
+			m.Stop(label);
+		}
+		for (uint i=0; i<40; i++)
+		{
+			snprintf(name, sizeof(name), "set%02u", i);
+			_fill(value, sizeof(value), (uint8)(i+pass));
+			bOk &= kv.put(name, value, sizeof(value));
+		}
+		snprintf(label, sizeof(label), "put %s%s", (pass) ? "change" : "new", how);
+		m.Stop(label, 40);
+		for (uint i=0; i<40; i++)
+		{
+			uint32 index = (i*7)%40;
+			snprintf(name, sizeof(name), "set%02u", index);
+			_fill(value, sizeof(value), (uint8)(index+pass));
+			bOk &= kv.get(name, got, sizeof(got), &len) && len==sizeof(got) && memcmp(value, got, sizeof(got))==0;
+		}
+		snprintf(label, sizeof(label), "get%s", how);
+		m.Stop(label, 40);
+		for (uint i=0; i<40; i++)
+		{
+			snprintf(name, sizeof(name), "none%02u", i);
+			bOk &= !kv.get(name, got, sizeof(got));
+		}
+		snprintf(label, sizeof(label), "get miss%s", how);
+		m.Stop(label, 40);
+	}
+	_check(bOk, "SFFS_KV put and get");
+	printf("  FRAM used: %u bytes file per value, %u bytes SFFS_KV\n", (uint)usedFiles, (uint)usedKv);
+
+	// Erased keys go, the keys probed past them stay, and their slots are used again
+	for (uint i=0; i<40; i+=4)
+	{
+		snprintf(name, sizeof(name), "set%02u", i);
+		bOk &= kv.erase(name) && !kv.get(name, got, sizeof(got));
+	}
+	m.Stop("erase, key index", 10);
+	vol.restart();
+	_check(kv.open("settings") && kv.Buckets()==64 && kv.ValueSize()==sizeof(value), "SFFS_KV open");
+	for (uint i=0; i<40; i++)
+	{
+		snprintf(name, sizeof(name), "set%02u", i);
+		_fill(value, sizeof(value), (uint8)(i+1));
+		bOk &= (kv.get(name, got, sizeof(got)) && memcmp(value, got, sizeof(got))==0) == (i%4 != 0);
+	}
+	_check(bOk, "SFFS_KV erase");
+	_check(kv.put("set00", value, 3) && kv.get("set00", got, sizeof(got), &len) && len==3, "SFFS_KV reuse");
+	_check(!kv.put("a-key-far-too-long", value, 1) && !kv.put("", value, 1) && !kv.put("big", value, sizeof(value)+1), "SFFS_KV limits");
+	_check(kv.create("small", 4, 4), "SFFS_KV small");
+	bOk = true;
+	for (uint i=0; i<4; i++)
+	{
+		snprintf(name, sizeof(name), "k%u", i);
+		bOk &= kv.put(name, value, 4);
+	}
+	_check(bOk && !kv.put("k4", value, 4) && kv.erase("k1") && kv.put("k4", value, 4), "SFFS_KV full");
+}
+
+// Host time per byte of the CRC-32 kernel this build uses
+static double
+_crcNsPerByte()
+{
+	static uint8 buf[65536];
+	struct timespec start, end;
+	volatile uint32 crc = 0;
+	const uint32 passes = 64;
+
+	_fill(buf, sizeof(buf), 9);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (uint32 i=0; i<passes; i++)
+		crc = SFFS_CRC::Calc(crc, buf, sizeof(buf));
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return ((end.tv_sec-start.tv_sec)*1e9 + (end.tv_nsec-start.tv_nsec))/((double)passes*sizeof(buf));
+}
+
+// An 8KB file written whole, then in 64 byte pieces at the end and over the middle, as a
+// plain file and as an SFFS_FILE_CRC one. Overwrites read the old data back for the CRC.
+static void
+bench_crc(eSimBus bus, uint32 framSize)
+{
+	static uint8 wbuf[BENCH_DATA_FILE];
+	static uint8 rbuf[BENCH_DATA_FILE];
+	SFFS_Volume_Sim vol;
+	SFFS_File file(vol);
+	SFFS_REQUEST req;
+	char label[48];
+
+	vol.begin(bus, framSize);
+	vol.VolumeCreate("Bench");
+	cMeasure m(vol.Driver().Fram());
+	_fill(wbuf, sizeof(wbuf), 3);
+
+	for (uint bCrc=0; bCrc<2; bCrc++)
+	{
+		const char* name = (bCrc) ? "crc" : "plain";
+		_check(file.fCreate(name, sizeof(wbuf), (bCrc) ? SFFS_FILE_CRC : 0), "fCreate crc");
+		m.Start();
+		file.fWrite(wbuf, sizeof(wbuf)/2);
+		snprintf(label, sizeof(label), "fWrite 4096, %s", name);
+		m.Stop(label);
+		for (uint i=0; i<32; i++)
+			file.fWrite(&wbuf[sizeof(wbuf)/2+i*64], 64);
+		snprintf(label, sizeof(label), "fWrite 64 append, %s", name);
+		m.Stop(label, 32);
+		for (uint i=0; i<32; i++)
+		{
+			_fill(&wbuf[1024+i*128], 64, (uint8)i);
+			file.fWriteAt(1024+i*128, &wbuf[1024+i*128], 64);
+		}
+		snprintf(label, sizeof(label), "fWriteAt 64 overwrite, %s", name);
+		m.Stop(label, 32);
+	}
+
+	// The CRC survives a reboot and matches the data read back
+	sIO_VEC vec[3] = { { 10, &wbuf[10], 20 }, { 20, &wbuf[20], 30 }, { 6000, &wbuf[6000], 200 } };
+	_fill(&wbuf[10], 40, 0x55);
+	_fill(&wbuf[6000], 200, 0x66);
+	_check(file.fWriteV(vec, 3)==250, "crc fWriteV");
+	_fill(&wbuf[6200], 1992, 0x77);
+	_check(file.fWriteAsync(&req, 6200, &wbuf[6200], 1992), "crc fWriteAsync");
+	vol.AsyncWait();
+	vol.restart();
+	_check(file.fOpen("crc") && file.fSize()==sizeof(wbuf), "crc fOpen");
+	m.Start();
+	_check(file.fVerify(), "crc fVerify");
+	m.Stop("fVerify 8192");
+	static uint8 verifyAhead[1024];
+	file.fReadAhead(verifyAhead, sizeof(verifyAhead));
+	m.Start();
+	_check(file.fVerify(), "crc fVerify read-ahead");
+	m.Stop("fVerify 8192, 1KB read-ahead");
+	file.fReadAhead(NULL, 0);
+	_check(file.fReadAt(0, rbuf, sizeof(rbuf))==sizeof(rbuf) && memcmp(wbuf, rbuf, sizeof(wbuf))==0, "crc data");
+	_check(file.fCrc()==SFFS_CRC::Calc(0, rbuf, sizeof(rbuf)), "crc fCrc");
+
+	// A byte changed behind the file system's back
+	SFFS_FILE_HEAD head;
+	vol.Stream().Read(vol.FileMemStart()+file.index()*vol.FileHeadSize(), &head, sizeof(head));
+	rbuf[0] = 0;
+	vol.Stream().Write(head.dataOffset+5000, rbuf, 1);
+	_check(!file.fVerify(), "crc fVerify corrupt");
+	_check(file.fCreate("log", 64, SFFS_FILE_CRC | SFFS_FILE_LOG)==false, "crc log refused");
+
+	snprintf(label, sizeof(label), "  CRC-32 kernel %d, %.2f host ns per byte", SFFS_CRC_KERNEL, _crcNsPerByte());
+	printf("%s\n", label);
+	uint32 crcA = SFFS_CRC::Calc(0, "12345", 5);
+	uint32 crcB = SFFS_CRC::Calc(0, "6789", 4);
+	_check(SFFS_CRC::Calc(0, "123456789", 9)==0xCBF43926UL && SFFS_CRC::Calc(crcA, "6789", 4)==0xCBF43926UL, "crc check value");
+	_check(SFFS_CRC::Combine(crcA, crcB, 4)==0xCBF43926UL, "crc combine");
+}
+
+// 8KB reads from an SPI FRAM at a range of clocks, with READ and FSTRD. The clock is set
+// for each transaction, so another device changing the bus set up has no effect.
+static void
+bench_spi_clock()
+{
+	static const uint32 clocks[] = { 1000000, 2000000, 4000000, 8000000, 20000000 };
+	static uint8 wbuf[BENCH_DATA_FILE];
+	static uint8 rbuf[BENCH_DATA_FILE];
+	cFRAM_Sim fram;
+	SFFS_Volume_SPI vol;
+	SFFS_File file(vol);
+	char label[48];
+
+	fram.Create(32768, 2, true);
+	cFRAM_Sim::AttachSPI(SIM_SPI_CS_PIN, &fram);
+	_check(vol.begin(SIM_SPI_CS_PIN) && vol.VolumeCreate("Bench") && file.fCreate("data", sizeof(wbuf)), "SPI clock volume");
+	_fill(wbuf, sizeof(wbuf), 5);
+	file.fWriteAt(0, wbuf, sizeof(wbuf));
+
+	cMeasure m(fram);
+	for (uint i=0; i<sizeof(clocks)/sizeof(clocks[0]); i++)
+	{
+		for (uint fast=0; fast<2; fast++)
+		{
+			memset(rbuf, 0, sizeof(rbuf));
+			vol.begin(SIM_SPI_CS_PIN, 2, clocks[i], fast==1);
+			file.fOpen("data");
+			m.Start();
+			file.fReadAt(0, rbuf, sizeof(rbuf));
+			snprintf(label, sizeof(label), "fRead 8192, %luMHz %s", (unsigned long)(clocks[i]/1000000), (fast) ? "FSTRD" : "READ");
+			m.Stop(label);
+			_check(memcmp(rbuf, wbuf, sizeof(rbuf))==0, "SPI clock data");
+		}
+	}
+
+	// Another device leaves the bus at its own, slower, set up
+	double us[2];
+	for (uint i=0; i<2; i++)
+	{
+		if (i==1)
+			SPI.setClockDivider(SPI_CLOCK_DIV128);
+		double start = fram.Stats().us;
+		file.fReadAt(0, rbuf, 64);
+		us[i] = fram.Stats().us-start;
+	}
+	_check(us[0]==us[1], "SPI settings per transaction");
+	cFRAM_Sim::AttachSPI(SIM_SPI_CS_PIN, NULL);
+}
+
+#if SFFS_STATS
+// The volume's own counters, against what the simulated FRAM saw
+static void
+bench_stats(eSimBus bus, uint32 framSize)
+{
+	static const char* opNames[SFFS_OPS] = { "open", "create", "read", "write", "append", "sync", "delete" };
+	uint8 buf[BENCH_SMALL_FILE];
+	char name[16];
+	SFFS_Volume_Sim vol;
+	SFFS_File file(vol);
+
+	vol.begin(bus, framSize);
+	vol.VolumeCreate("Bench");
+	vol.VolumeStatsReset();
+	cFRAM_Sim& fram = vol.Driver().Fram();
+	fram.ResetStats();
+
+	_fill(buf, sizeof(buf), 1);
+	for (uint i=0; i<10; i++)
+	{
+		snprintf(name, sizeof(name), "stat%u", i);
+		file.fCreate(name, sizeof(buf));
+		file.fWrite(buf, sizeof(buf));
+	}
+	_check(file.fStats().writes==1 && file.fStats().bytesWritten==sizeof(buf), "file stats write");
+	file.fOpen("stat3");
+	file.fReadAt(0, buf, sizeof(buf));
+	file.fReadAt(8, buf, 8);
+	_check(file.fStats().reads==2 && file.fStats().bytesRead==sizeof(buf)+8, "file stats read");
+	file.fDelete();
+	file.fSync();
+
+	SFFS_VOLUME_STATS& stats = vol.VolumeStats();
+	printf("  %s bus: %lu txns (%lu WREN), %lu bytes read, %lu written\n", (bus==SIM_BUS_SPI) ? "SPI" : "I2C",
+		(unsigned long)stats.bus.transactions, (unsigned long)stats.bus.writeEnables,
+		(unsigned long)stats.bus.bytesRead, (unsigned long)stats.bus.bytesWritten);
+	printf("  headers: %lu reads, %lu writes, %lu bytes; data: %lu reads, %lu writes, %lu bytes\n",
+		(unsigned long)stats.headReads, (unsigned long)stats.headWrites, (unsigned long)stats.headBytes,
+		(unsigned long)stats.dataReads, (unsigned long)stats.dataWrites, (unsigned long)stats.dataBytes);
+	printf("  directory: %lu headers read, %lu skipped by the index\n",
+		(unsigned long)stats.dirSteps, (unsigned long)stats.dirSkips);
+	for (uint op=0; op<SFFS_OPS; op++)
+	{
+		printf("  %-8s", opNames[op]);
+		for (uint b=0; b<SFFS_STATS_BUCKETS; b++)
+		{
+			if (stats.latency[op][b])
+				printf(" <%luus:%u", 1UL<<b, stats.latency[op][b]);
+		}
+		printf("\n");
+	}
+	_check(stats.bus.transactions==fram.Stats().transactions, "bus transactions match the FRAM");
+	_check(stats.dataWrites>=10 && stats.dataBytes>=10*sizeof(buf), "data counted");
+	_check(stats.latency[SFFS_OP_CREATE][0]+stats.latency[SFFS_OP_CREATE][SFFS_STATS_BUCKETS-1] < 10, "create timed");
+
+	vol.VolumeStatsReset();
+	_check(vol.VolumeStats().bus.transactions==0 && vol.VolumeStats().headReads==0, "stats reset");
+}
+#endif
+
+int
+main()
+{
+	printf("SFFS host benchmark, per call averages\n");
+	printf("Wire buffer: %d bytes\n", BUFFER_LENGTH);
+#if SFFS_CACHE_LINES > 0
+	printf("Block cache: %d lines of %d bytes\n", SFFS_CACHE_LINES, SFFS_CACHE_LINE_SIZE);
+#endif
+
+	_header("SPI FRAM 256Kbit (32KB, 16bit address), SPI_CLOCK_DIV2");
+	bench_files(SIM_BUS_SPI, 32768);
+	_header("I2C FRAM 256Kbit (32KB), 100kHz");
+	bench_files(SIM_BUS_I2C, 32768);
+
+	_header("Mount cost by FRAM size");
+	bench_init(SIM_BUS_SPI, 8192);
+	bench_init(SIM_BUS_SPI, 32768);
+	bench_init(SIM_BUS_SPI, 262144);
+	bench_init(SIM_BUS_I2C, 32768);
+	bench_init(SIM_BUS_I2C, 131072);
+	bench_v1_volume();
+	bench_v2_volume();
+
+	_header("Logging 12 byte samples, SPI 32KB");
+	bench_log(SIM_BUS_SPI, 32768);
+	_header("Logging 12 byte samples, I2C 32KB");
+	bench_log(SIM_BUS_I2C, 32768);
+	_header("Ring of 64 x 16 byte records, SPI 32KB");
+	bench_ring(SIM_BUS_SPI, 32768);
+	_header("Ring of 64 x 16 byte records, I2C 32KB");
+	bench_ring(SIM_BUS_I2C, 32768);
+
+	_header("Queued 4KB snapshot, SPI 32KB");
+	bench_async(SIM_BUS_SPI, 32768);
+	_header("Queued 4KB snapshot, I2C 32KB");
+	bench_async(SIM_BUS_I2C, 32768);
+
+	_header("Deleting and compacting, SPI 32KB");
+	bench_delete(SIM_BUS_SPI, 32768);
+	_header("Deleting and compacting, I2C 32KB");
+	bench_delete(SIM_BUS_I2C, 32768);
+
+	_header("SPI 32KB and I2C 32KB volumes mounted together");
+	bench_volumes();
+
+	printf("\nSPI FRAMs of 32KB striped 256 bytes, time serial on one bus or parallel on one each\n");
+	printf("  %-32s %8s %10s %12s %12s\n", "operation", "txns", "bus bytes", "serial us", "parallel us");
+	bench_striped(1);
+	bench_striped(2);
+	bench_striped(3);
+	bench_striped(4);
+
+	_header("I2C FRAM 1Mbit (128KB), driver calls");
+	bench_i2c_page();
+	_header("2KB struct, 100 updates of a counter and one setting, SPI 32KB");
+	bench_persistent(SIM_BUS_SPI, 32768);
+	_header("2KB struct, 100 updates of a counter and one setting, I2C 32KB");
+	bench_persistent(SIM_BUS_I2C, 32768);
+
+	_header("256 byte record, 100 updates then a boot, SPI 32KB");
+	bench_atomic(SIM_BUS_SPI, 32768);
+	_header("256 byte record, 100 updates then a boot, I2C 32KB");
+	bench_atomic(SIM_BUS_I2C, 32768);
+
+	_header("200 x 16 byte records, SPI 32KB");
+	bench_records(SIM_BUS_SPI, 32768);
+	_header("200 x 16 byte records, I2C 32KB");
+	bench_records(SIM_BUS_I2C, 32768);
+
+	_header("40 settings of 16 bytes, file per value and SFFS_KV, SPI 32KB");
+	bench_kv(SIM_BUS_SPI, 32768);
+	_header("40 settings of 16 bytes, file per value and SFFS_KV, I2C 32KB");
+	bench_kv(SIM_BUS_I2C, 32768);
+
+	_header("8KB file, plain and SFFS_FILE_CRC, SPI 32KB");
+	bench_crc(SIM_BUS_SPI, 32768);
+	_header("8KB file, plain and SFFS_FILE_CRC, I2C 32KB");
+	bench_crc(SIM_BUS_I2C, 32768);
+
+	_header("SPI FRAM 256Kbit (32KB) by clock, 8MHz is the most a 16MHz AVR gives");
+	bench_spi_clock();
+	_header("SPI FRAM 256Kbit (32KB), driver binding");
+	bench_binding();
+
+#if SFFS_STATS
+	printf("\nVolume statistics, 10 small files written, one read back and deleted\n");
+	bench_stats(SIM_BUS_SPI, 32768);
+	bench_stats(SIM_BUS_I2C, 32768);
+#endif
+
+	if (s_failures)
+	{
+		printf("\n%d check(s) FAILED\n", s_failures);
+		return 1;
+	}
+	printf("\nAll checks passed\n");
+	return 0;
+}
@@ -0,0 +1,41 @@
+/**************************************************************************/
+/*!
+    @file     sffs_sim.cpp
+    @author   Paul Holmes
+    @license  BSD (see LICENSE)
+
+    Host side simulated FRAM driver, see sffs_sim.h
+*/
+/**************************************************************************/
+#include "sffs_sim.h"
+
+bool
+cIO_DRV_Sim::Init(eSimBus bus, uint32 framSize, uint8 busAddr, bool bDeviceId)
+{
+	m_bus = bus;
+	m_busAddr = busAddr;
+	if (m_busAddr==0)
+		m_busAddr = (m_bus==SIM_BUS_SPI) ? SIM_SPI_CS_PIN : I2C_DEFAULT_ADDRESS;
+	// I2C parts top out at 1Mbit (17bit addressing)
+	if (m_bus==SIM_BUS_I2C && framSize>0x20000)
+		return false;
+	if (!m_fram.Create(framSize, 0, bDeviceId))
+		return false;
+	if (m_bus==SIM_BUS_SPI)
+		cFRAM_Sim::AttachSPI(m_busAddr, &m_fram);
+	else
+		cFRAM_Sim::AttachI2C(m_busAddr, &m_fram);
+	return Restart();
+}
+
+bool
+cIO_DRV_Sim::Restart()
+{
+	if (m_bus==SIM_BUS_SPI)
+	{
+		m_pBus = &m_spi;
+		return m_spi.Init(m_busAddr, m_fram.AddrWidth());
+	}
+	m_pBus = &m_i2c;
+	return m_i2c.Init(m_busAddr);
+}
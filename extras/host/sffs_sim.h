@@ -0,0 +1,112 @@
+/**************************************************************************/
+/*!
+    @file     sffs_sim.h
+    @author   Paul Holmes
+    @license  BSD (see LICENSE)
+
+    Host side simulated FRAM driver and volume.
+
+    cIO_DRV_Sim owns a RAM backed FRAM (cFRAM_Sim) and runs the real
+    cIO_DRV_SPI or cIO_DRV_I2C driver against it, so the bus statistics
+    reflect exactly what the drivers would put on the wire.
+*/
+/**************************************************************************/
+#ifndef _sffs_sim_h
+#define _sffs_sim_h
+
+#include "sim_fram.h"
+#include "SFFS.h"
+
+#define SIM_SPI_CS_PIN 10
+
+typedef enum {
+	SIM_BUS_SPI,
+	SIM_BUS_I2C
+}eSimBus;
+
+class cIO_DRV_Sim : public cIO_DRV
+{
+public:
+	cIO_DRV_Sim() : cIO_DRV(),
+			m_pBus(NULL),
+			m_bus(SIM_BUS_SPI),
+			m_busAddr(0)
+	{
+	}
+	// Create a blank FRAM of framSize bytes on a CS pin or I2C address (0 for the default),
+	// bDeviceId false simulates a part that can not report its ID
+	bool Init(eSimBus bus, uint32 framSize, uint8 busAddr=0, bool bDeviceId=true);
+	// Re-initialise the bus driver, keeping the FRAM contents (a warm restart)
+	bool Restart();
+
+	virtual uint32 Read(uint32 offset, void* pBuf, uint32 count)
+	{
+		return m_pBus->Read(offset, pBuf, count);
+	}
+	virtual uint32 Write(uint32 offset, const void* pBuf, uint32 count)
+	{
+		return m_pBus->Write(offset, pBuf, count);
+	}
+	virtual uint32 ReadV(const sIO_VEC* pVec, uint count)
+	{
+		return m_pBus->ReadV(pVec, count);
+	}
+	virtual uint32 WriteV(const sIO_VEC* pVec, uint count)
+	{
+		return m_pBus->WriteV(pVec, count);
+	}
+	virtual uint32 DeviceSize()
+	{
+		return m_pBus->DeviceSize();
+	}
+#if SFFS_STATS
+	virtual void AddBusStats(sIO_STATS* pStats)
+	{
+		m_pBus->AddBusStats(pStats);
+	}
+	virtual void ResetBusStats()
+	{
+		m_pBus->ResetBusStats();
+	}
+#endif
+
+	cFRAM_Sim& Fram()
+	{
+		return m_fram;
+	}
+	eSimBus Bus()
+	{
+		return m_bus;
+	}
+protected:
+	virtual void _beginWriteSession()
+	{
+		m_pBus->BeginWrite();
+	}
+	virtual void _endWriteSession()
+	{
+		m_pBus->EndWrite();
+	}
+private:
+	cFRAM_Sim m_fram;
+	cIO_DRV_SPI m_spi;
+	cIO_DRV_I2C m_i2c;
+	cIO_DRV* m_pBus;
+	eSimBus m_bus;
+	uint8 m_busAddr;
+};
+
+// begin(eSimBus bus, uint32 framSize, uint8 busAddr=0, bool bDeviceId=true)
+class SFFS_Volume_Sim : public SFFS_VolumeT<cIO_DRV_Sim>
+{
+public:
+	// Power cycle: mount again from what is on the FRAM
+	bool restart()
+	{
+		if (Driver().Restart())
+			return init();
+		return false;
+	}
+};
+
+#endif //_sffs_sim_h
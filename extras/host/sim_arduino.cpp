@@ -0,0 +1,283 @@
+/**************************************************************************/
+/*!
+    @file     sim_arduino.cpp
+    @author   Paul Holmes
+    @license  BSD (see LICENSE)
+
+    Host implementation of the Arduino, SPI and Wire stand-ins, routing
+    bus traffic to the simulated FRAM devices in sim_fram.cpp.
+*/
+/**************************************************************************/
+#include "Arduino.h"
+#include "SPI.h"
+#include "Wire.h"
+#include "sim_fram.h"
+
+HardwareSerial Serial;
+SPIClass SPI;
+TwoWire Wire;
+
+static cFRAM_Sim* s_pSelected = NULL;
+static cFRAM_Sim* s_pIdTarget = NULL;
+
+/**********************************************************************
+//
+// Core
+//
+***********************************************************************/
+void
+pinMode(uint8_t pin, uint8_t mode)
+{
+	(void)pin;
+	(void)mode;
+}
+
+void
+digitalWrite(uint8_t pin, uint8_t val)
+{
+	cFRAM_Sim* pFram = cFRAM_Sim::SpiDevice(pin);
+	if (pFram)
+	{
+		pFram->Charge(SIM_DIGITALWRITE_US);
+		if (val==LOW)
+		{
+			s_pSelected = pFram;
+			pFram->SpiSelect(true);
+		}
+		else if (s_pSelected==pFram)
+		{
+			pFram->SpiSelect(false);
+			s_pSelected = NULL;
+		}
+	}
+}
+
+unsigned long
+micros()
+{
+	return (unsigned long)cFRAM_Sim::Clock();
+}
+
+unsigned long
+millis()
+{
+	return micros()/1000;
+}
+
+void
+delay(unsigned long ms)
+{
+	(void)ms;
+}
+
+void
+delayMicroseconds(unsigned int us)
+{
+	(void)us;
+}
+
+size_t
+HardwareSerial::print(const char* s)
+{
+	return (size_t)printf("%s", s);
+}
+size_t
+HardwareSerial::print(char c)
+{
+	return (size_t)printf("%c", c);
+}
+size_t
+HardwareSerial::print(long n, int base)
+{
+	return (size_t)printf((base==HEX) ? "%lX" : "%ld", n);
+}
+size_t
+HardwareSerial::print(unsigned long n, int base)
+{
+	return (size_t)printf((base==HEX) ? "%lX" : "%lu", n);
+}
+size_t
+HardwareSerial::print(double n, int digits)
+{
+	return (size_t)printf("%.*f", digits, n);
+}
+size_t
+HardwareSerial::println()
+{
+	return (size_t)printf("\n");
+}
+
+/**********************************************************************
+//
+// SPI
+//
+***********************************************************************/
+SPIClass::SPIClass() :
+		m_clock(SIM_F_CPU/4)
+{
+}
+
+void
+SPIClass::begin()
+{
+}
+
+void
+SPIClass::end()
+{
+}
+
+// As the AVR core, the fastest power of two divider of the CPU clock, 2 at the least,
+// that is not over the clock asked for
+void
+SPIClass::beginTransaction(SPISettings settings)
+{
+	m_clock = SIM_F_CPU/2;
+	while (m_clock > settings.m_clock && m_clock > SIM_F_CPU/128)
+		m_clock /= 2;
+}
+
+void
+SPIClass::endTransaction()
+{
+}
+
+void
+SPIClass::setClockDivider(uint8_t div)
+{
+	static const uint8_t shift[8] = { 2, 4, 6, 7, 1, 3, 5, 6 };
+	m_clock = SIM_F_CPU >> shift[div & 0x07];
+}
+
+uint8_t
+SPIClass::transfer(uint8_t data)
+{
+	if (s_pSelected==NULL)
+		return 0xFF;
+	s_pSelected->Charge(SIM_SPI_CALL_US + (8*1e6)/m_clock);
+	s_pSelected->BusBytes(1);
+	return s_pSelected->SpiTransfer(data);
+}
+
+void
+SPIClass::transfer(void* pBuf, size_t count)
+{
+	if (s_pSelected==NULL)
+		return;
+	s_pSelected->Charge(SIM_SPI_BULK_CALL_US + count*(SIM_SPI_BULK_BYTE_US + (8*1e6)/m_clock));
+	s_pSelected->BusBytes(count);
+	for (size_t i=0; i<count; i++)
+		((uint8_t*)pBuf)[i] = s_pSelected->SpiTransfer(((uint8_t*)pBuf)[i]);
+}
+
+/**********************************************************************
+//
+// Wire
+//
+***********************************************************************/
+TwoWire::TwoWire() :
+		m_clock(100000),
+		m_txAddress(0),
+		m_txLength(0),
+		m_rxLength(0),
+		m_rxIndex(0)
+{
+}
+
+void
+TwoWire::begin()
+{
+	m_clock = 100000;
+}
+
+void
+TwoWire::beginTransmission(uint8_t address)
+{
+	m_txAddress = address;
+	m_txLength = 0;
+}
+
+size_t
+TwoWire::write(uint8_t data)
+{
+	if (m_txLength>=BUFFER_LENGTH)
+		return 0;
+	m_txBuffer[m_txLength++] = data;
+	return 1;
+}
+
+size_t
+TwoWire::write(const uint8_t* pData, size_t count)
+{
+	size_t done = 0;
+	while (done<count && write(pData[done]))
+		done++;
+	return done;
+}
+
+uint8_t
+TwoWire::endTransmission(uint8_t sendStop)
+{
+	(void)sendStop;
+	cFRAM_Sim* pFram = cFRAM_Sim::I2cDevice(m_txAddress);
+	if (m_txAddress==SIM_I2C_DEVICE_ID_ADDRESS && m_txLength>0)
+	{
+		// Device ID read, the first byte selects the device
+		pFram = cFRAM_Sim::I2cDevice(m_txBuffer[0]>>1);
+		s_pIdTarget = pFram;
+		m_txLength = 0;
+	}
+	if (pFram==NULL)
+		return 2;
+	uint32_t bytes = 1+m_txLength;
+	pFram->Charge(SIM_I2C_TXN_US + ((bytes*SIM_I2C_BITS_PER_BYTE)+SIM_I2C_START_STOP_BITS)*1e6/m_clock);
+	pFram->BusBytes(bytes);
+	pFram->I2cWrite(m_txAddress, m_txBuffer, m_txLength);
+	m_txLength = 0;
+	return 0;
+}
+
+uint8_t
+TwoWire::requestFrom(uint8_t address, uint8_t quantity, uint8_t sendStop)
+{
+	(void)sendStop;
+	m_rxIndex = 0;
+	m_rxLength = 0;
+	cFRAM_Sim* pFram = cFRAM_Sim::I2cDevice(address);
+	if (address==SIM_I2C_DEVICE_ID_ADDRESS)
+	{
+		uint8_t id[3];
+		pFram = s_pIdTarget;
+		s_pIdTarget = NULL;
+		if (pFram==NULL || !pFram->I2cDeviceId(id))
+			return 0;
+		pFram->Charge(SIM_I2C_TXN_US + ((4*SIM_I2C_BITS_PER_BYTE)+SIM_I2C_START_STOP_BITS)*1e6/m_clock);
+		pFram->BusBytes(4);
+		for (m_rxLength=0; m_rxLength<sizeof(id) && m_rxLength<quantity; m_rxLength++)
+			m_rxBuffer[m_rxLength] = id[m_rxLength];
+		return m_rxLength;
+	}
+	if (pFram==NULL)
+		return 0;
+	if (quantity>BUFFER_LENGTH)
+		quantity = BUFFER_LENGTH;
+	uint32_t bytes = 1+quantity;
+	pFram->Charge(SIM_I2C_TXN_US + ((bytes*SIM_I2C_BITS_PER_BYTE)+SIM_I2C_START_STOP_BITS)*1e6/m_clock);
+	pFram->BusBytes(bytes);
+	m_rxLength = (uint8_t)pFram->I2cRead(address, m_rxBuffer, quantity);
+	return m_rxLength;
+}
+
+int
+TwoWire::available()
+{
+	return m_rxLength-m_rxIndex;
+}
+
+int
+TwoWire::read()
+{
+	if (m_rxIndex>=m_rxLength)
+		return -1;
+	return m_rxBuffer[m_rxIndex++];
+}
@@ -0,0 +1,257 @@
+/**************************************************************************/
+/*!
+    @file     sim_fram.cpp
+    @author   Paul Holmes
+    @license  BSD (see LICENSE)
+
+    RAM backed FRAM model, see sim_fram.h
+*/
+/**************************************************************************/
+#include "sim_fram.h"
+
+#define SPI_CMD_READ   0x03
+#define SPI_CMD_FSTRD  0x0B
+#define SPI_CMD_WRITE  0x02
+#define SPI_CMD_WREN   0x06
+#define SPI_CMD_WRDI   0x04
+#define SPI_CMD_RDSR   0x05
+#define SPI_CMD_RDID   0x9F
+
+#define SIM_MAX_PINS 64
+#define SIM_MAX_I2C  128
+
+static cFRAM_Sim* s_spiDevices[SIM_MAX_PINS];
+static cFRAM_Sim* s_i2cDevices[SIM_MAX_I2C];
+static double s_clock = 0;
+
+
+cFRAM_Sim::cFRAM_Sim() :
+		m_pMem(NULL),
+		m_size(0),
+		m_addrWidth(2),
+		m_bDeviceId(true),
+		m_spiState(SPI_IDLE),
+		m_spiOp(SPI_IDLE),
+		m_addrLeft(0),
+		m_bWel(false),
+		m_addr(0)
+{
+	ResetStats();
+}
+
+cFRAM_Sim::~cFRAM_Sim()
+{
+	free(m_pMem);
+}
+
+bool
+cFRAM_Sim::Create(uint32_t size, uint8_t addrWidth, bool bDeviceId)
+{
+	// The address counter wraps at the end of the array, so only powers of two
+	if (size==0 || (size & (size-1))!=0)
+		return false;
+	free(m_pMem);
+	m_pMem = (uint8_t*)calloc(size, 1);
+	m_size = size;
+	m_addrWidth = (addrWidth) ? addrWidth : ((size > 0x10000) ? 3 : 2);
+	m_bDeviceId = bDeviceId;
+	m_bWel = false;
+	m_addr = 0;
+	ResetStats();
+	return (m_pMem!=NULL);
+}
+
+void
+cFRAM_Sim::ResetStats()
+{
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
+void
+cFRAM_Sim::Charge(double us)
+{
+	m_stats.us += us;
+	s_clock += us;
+}
+
+//static
+double
+cFRAM_Sim::Clock()
+{
+	return s_clock;
+}
+
+/**********************************************************************
+//
+// SPI slave
+//
+***********************************************************************/
+void
+cFRAM_Sim::SpiSelect(bool bSelect)
+{
+	if (bSelect)
+	{
+		m_stats.transactions++;
+		m_spiState = SPI_CMD;
+		m_spiOp = SPI_IDLE;
+	}
+	else
+	{
+		// The write enable latch is reset when CS rises after a WRITE
+		if (m_spiOp==SPI_WRITE)
+			m_bWel = false;
+		m_spiState = SPI_IDLE;
+	}
+}
+
+uint8_t
+cFRAM_Sim::SpiTransfer(uint8_t data)
+{
+	uint8_t out = 0xFF;
+
+	switch (m_spiState)
+	{
+	case SPI_CMD:
+		m_spiState = SPI_IGNORE;
+		switch (data)
+		{
+		case SPI_CMD_WREN:
+		case SPI_CMD_WRDI:
+			m_bWel = (data==SPI_CMD_WREN);
+			m_stats.wrenCycles++;
+			break;
+		case SPI_CMD_RDSR:
+			m_spiState = SPI_STATUS;
+			break;
+		case SPI_CMD_RDID:
+			if (m_bDeviceId)
+			{
+				m_spiState = SPI_RDID;
+				m_addrLeft = 0;
+			}
+			break;
+		case SPI_CMD_READ:
+		case SPI_CMD_WRITE:
+			m_spiOp = (data==SPI_CMD_READ) ? SPI_READ : SPI_WRITE;
+			m_spiState = SPI_ADDR;
+			m_addrLeft = m_addrWidth;
+			m_addr = 0;
+			break;
+		case SPI_CMD_FSTRD:
+			// As READ, with a dummy byte after the address
+			m_spiOp = SPI_FAST_READ;
+			m_spiState = SPI_ADDR;
+			m_addrLeft = m_addrWidth;
+			m_addr = 0;
+			break;
+		}
+		break;
+	case SPI_ADDR:
+		m_addr = (m_addr<<8) | data;
+		if (--m_addrLeft==0)
+			m_spiState = (m_spiOp==SPI_FAST_READ) ? SPI_DUMMY : m_spiOp;
+		break;
+	case SPI_DUMMY:
+		m_spiState = SPI_READ;
+		break;
+	case SPI_READ:
+		out = _readArray();
+		break;
+	case SPI_WRITE:
+		if (m_bWel)
+			_writeArray(data);
+		break;
+	case SPI_STATUS:
+		out = (m_bWel) ? 0x02 : 0x00;
+		break;
+	case SPI_RDID:
+		{
+			// Fujitsu manufacturer ID and continuation code, then the product ID
+			const uint8_t id[4] = { 0x04, 0x7F, _density(), 0x09 };
+			out = (m_addrLeft<sizeof(id)) ? id[m_addrLeft++] : 0x00;
+		}
+		break;
+	default:
+		break;
+	}
+	return out;
+}
+
+/**********************************************************************
+//
+// I2C slave
+//
+***********************************************************************/
+bool
+cFRAM_Sim::I2cWrite(uint8_t devAddr, const uint8_t* pData, uint32_t count)
+{
+	m_stats.transactions++;
+	if (count<2)
+		return true;
+	m_addr = ((devAddr & 0x01) ? 0x10000 : 0) | ((uint32_t)pData[0]<<8) | pData[1];
+	for (uint32_t i=2; i<count; i++)
+		_writeArray(pData[i]);
+	return true;
+}
+
+bool
+cFRAM_Sim::I2cDeviceId(uint8_t* pId)
+{
+	if (!m_bDeviceId)
+		return false;
+	// Fujitsu (0x00A), density, product
+	pId[0] = 0x00;
+	pId[1] = 0xA0 | _density();
+	pId[2] = 0x10;
+	return true;
+}
+
+uint32_t
+cFRAM_Sim::I2cRead(uint8_t devAddr, uint8_t* pData, uint32_t count)
+{
+	(void)devAddr;
+	m_stats.transactions++;
+	for (uint32_t i=0; i<count; i++)
+		pData[i] = _readArray();
+	return count;
+}
+
+/**********************************************************************
+//
+// Bus wiring
+//
+***********************************************************************/
+//static
+void
+cFRAM_Sim::AttachSPI(uint8_t csPin, cFRAM_Sim* pFram)
+{
+	if (csPin<SIM_MAX_PINS)
+		s_spiDevices[csPin] = pFram;
+}
+//static
+cFRAM_Sim*
+cFRAM_Sim::SpiDevice(uint8_t csPin)
+{
+	return (csPin<SIM_MAX_PINS) ? s_spiDevices[csPin] : NULL;
+}
+//static
+void
+cFRAM_Sim::AttachI2C(uint8_t hwAddr, cFRAM_Sim* pFram)
+{
+	if (hwAddr<SIM_MAX_I2C)
+		s_i2cDevices[hwAddr] = pFram;
+}
+//static
+cFRAM_Sim*
+cFRAM_Sim::I2cDevice(uint8_t devAddr)
+{
+	if (devAddr>=SIM_MAX_I2C)
+		return NULL;
+	if (s_i2cDevices[devAddr])
+		return s_i2cDevices[devAddr];
+	// 1Mbit parts answer on both values of the A16 page bit
+	cFRAM_Sim* pFram = s_i2cDevices[devAddr & ~0x01];
+	if (pFram && pFram->Size() > 0x10000)
+		return pFram;
+	return NULL;
+}
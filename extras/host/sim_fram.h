@@ -0,0 +1,127 @@
+/**************************************************************************/
+/*!
+    @file     sim_fram.h
+    @author   Paul Holmes
+    @license  BSD (see LICENSE)
+
+    RAM backed model of an SPI or I2C FRAM chip, plus the bus cost model
+    used by the host SPI/Wire stand-ins.
+
+    The SPI model follows the MB85RS/FM25 command set: WREN must precede
+    every WRITE, and the write enable latch is cleared when CS rises after
+    a WRITE. The I2C model follows MB85RC parts: a two byte word address,
+    A16 carried in bit 0 of the device address, and "current address"
+    reads that carry on from the last byte accessed.
+*/
+/**************************************************************************/
+#ifndef _sim_fram_h
+#define _sim_fram_h
+
+#include "Arduino.h"
+
+//
+// Bus cost model, roughly an AVR at 16MHz
+//
+#define SIM_F_CPU                16000000UL
+#define SIM_DIGITALWRITE_US      3.0   // One digitalWrite() of a CS pin
+#define SIM_SPI_CALL_US          0.75  // Call and status polling overhead of SPI.transfer(byte)
+#define SIM_SPI_BULK_CALL_US     1.0   // Call overhead of SPI.transfer(buf, n)
+#define SIM_SPI_BULK_BYTE_US     0.25  // Per byte loop overhead of SPI.transfer(buf, n)
+#define SIM_I2C_TXN_US           25.0  // Software overhead of one Wire transmission or request
+#define SIM_I2C_BITS_PER_BYTE    9     // 8 data bits + ACK
+#define SIM_I2C_START_STOP_BITS  2
+
+typedef struct {
+	uint32_t transactions;  // CS assertions (SPI), START conditions (I2C)
+	uint32_t busBytes;      // All bytes on the bus, commands and addresses included
+	uint32_t wrenCycles;    // WREN/WRDI commands
+	uint32_t dataRead;      // Bytes read out of the memory array
+	uint32_t dataWritten;   // Bytes written into the memory array
+	double us;              // Simulated bus time
+}sSimStats;
+
+class cFRAM_Sim
+{
+public:
+	cFRAM_Sim();
+	~cFRAM_Sim();
+
+	// bDeviceId: the part answers RDID (SPI) or the Device ID read (I2C), as MB85RS/MB85RC parts do
+	bool Create(uint32_t size, uint8_t addrWidth=0, bool bDeviceId=true);
+	uint32_t Size()
+	{
+		return m_size;
+	}
+	uint8_t AddrWidth()
+	{
+		return m_addrWidth;
+	}
+	uint8_t* Mem()
+	{
+		return m_pMem;
+	}
+	sSimStats& Stats()
+	{
+		return m_stats;
+	}
+	void ResetStats();
+
+	// Bus accounting, used by the SPI/Wire stand-ins
+	void Charge(double us);
+	void BusBytes(uint32_t count)
+	{
+		m_stats.busBytes += count;
+	}
+
+	// SPI slave
+	void SpiSelect(bool bSelect);
+	uint8_t SpiTransfer(uint8_t data);
+
+	// I2C slave, one call per addressed write or read transaction
+	bool I2cWrite(uint8_t devAddr, const uint8_t* pData, uint32_t count);
+	uint32_t I2cRead(uint8_t devAddr, uint8_t* pData, uint32_t count);
+	bool I2cDeviceId(uint8_t* pId);
+
+	// Bus wiring
+	static void AttachSPI(uint8_t csPin, cFRAM_Sim* pFram);
+	static cFRAM_Sim* SpiDevice(uint8_t csPin);
+	static void AttachI2C(uint8_t hwAddr, cFRAM_Sim* pFram);
+	static cFRAM_Sim* I2cDevice(uint8_t devAddr);
+	static double Clock();
+private:
+	enum eSpiState { SPI_IDLE, SPI_CMD, SPI_ADDR, SPI_DUMMY, SPI_READ, SPI_FAST_READ, SPI_WRITE, SPI_STATUS, SPI_RDID, SPI_IGNORE };
+
+	uint8_t* m_pMem;
+	uint32_t m_size;
+	uint8_t m_addrWidth;
+	bool m_bDeviceId;
+	sSimStats m_stats;
+
+	// SPI state
+	eSpiState m_spiState;
+	eSpiState m_spiOp;
+	uint8_t m_addrLeft;
+	bool m_bWel;
+	uint32_t m_addr;
+
+	uint8_t _readArray()
+	{
+		m_stats.dataRead++;
+		return m_pMem[(m_addr++) & (m_size-1)];
+	}
+	void _writeArray(uint8_t data)
+	{
+		m_stats.dataWritten++;
+		m_pMem[(m_addr++) & (m_size-1)] = data;
+	}
+	// Fujitsu density code, size = 1KB << density
+	uint8_t _density()
+	{
+		uint8_t density = 0;
+		while ((1024UL<<density) < m_size)
+			density++;
+		return density;
+	}
+};
+
+#endif //_sim_fram_h
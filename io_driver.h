@@ -63,18 +63,66 @@
 #define int32 int32_t
 #endif
 
+// I/O statistics, read with SFFS_Volume::VolumeStats(), set here so the drivers see it too.
+// 0 compiles them out.
+#ifndef SFFS_STATS
+#define SFFS_STATS 0
+#endif
+
+#if SFFS_STATS
+#define IO_STAT(field, n) (m_stats.field += (n))
+#else
+#define IO_STAT(field, n)
+#endif
+
 typedef union {
 	uint32 Int32;
 	uint8 Bytes[4];
 }uAddress;
 
+// One range of a scattered read or write
+typedef struct {
+	uint32 offset;
+	void* pBuf;
+	uint32 count;
+}sIO_VEC;
+
+// Bus work done by a driver
+typedef struct {
+	uint32 transactions;	// One per CS assertion or I2C START
+	uint32 writeEnables;	// SPI WREN cycles
+	uint32 bytesRead;
+	uint32 bytesWritten;
+}sIO_STATS;
+
 
 class cIO_DRV
 {
 private:
+	uint8 m_writeSession;
 public:
-	cIO_DRV()
+	cIO_DRV() :
+			m_writeSession(0)
 	{
+#if SFFS_STATS
+		ResetBusStats();
+#endif
+	}
+	// Bracket a burst of Write() calls, so the driver can share the set up
+	// and tear down between them. Sessions can be nested.
+	void BeginWrite()
+	{
+		if (m_writeSession++ == 0)
+			_beginWriteSession();
+	}
+	void EndWrite()
+	{
+		if (m_writeSession > 0 && --m_writeSession == 0)
+			_endWriteSession();
+	}
+	bool InWriteSession()
+	{
+		return (m_writeSession > 0);
 	}
 	virtual uint8 ReadByte(uint32 offset)
 	{
@@ -88,26 +136,108 @@ public:
 	}
 	virtual uint32 Read(uint32 offset, void* pBuf, uint32 count) = 0;
 	virtual uint32 Write(uint32 offset, const void* pBuf, uint32 count) = 0;
+	// Read or write several ranges in one call, drivers can join ranges that follow on
+	// from each other into one bus transfer. Returns the total bytes done.
+	virtual uint32 ReadV(const sIO_VEC* pVec, uint count)
+	{
+		uint32 done = 0;
+		for (uint i=0; i<count; i++)
+			done += Read(pVec[i].offset, pVec[i].pBuf, pVec[i].count);
+		return done;
+	}
+	virtual uint32 WriteV(const sIO_VEC* pVec, uint count)
+	{
+		uint32 done = 0;
+		BeginWrite();
+		for (uint i=0; i<count; i++)
+			done += Write(pVec[i].offset, pVec[i].pBuf, pVec[i].count);
+		EndWrite();
+		return done;
+	}
+	// Size of the device as reported by its ID, or 0 if it can not tell
+	virtual uint32 DeviceSize()
+	{
+		return 0;
+	}
+#if SFFS_STATS
+	// Add this driver's counts to *pStats, drivers in front of others pass it on to them
+	virtual void AddBusStats(sIO_STATS* pStats)
+	{
+		pStats->transactions += m_stats.transactions;
+		pStats->writeEnables += m_stats.writeEnables;
+		pStats->bytesRead += m_stats.bytesRead;
+		pStats->bytesWritten += m_stats.bytesWritten;
+	}
+	virtual void ResetBusStats()
+	{
+		memset(&m_stats, 0, sizeof(m_stats));
+	}
+#endif
+protected:
+#if SFFS_STATS
+	sIO_STATS m_stats;
+#endif
+	virtual void _beginWriteSession()
+	{
+	}
+	virtual void _endWriteSession()
+	{
+	}
+	// Number of ranges from pVec[0] on, at least 1, that each start where the last ended
+	static uint _contiguous(const sIO_VEC* pVec, uint count)
+	{
+		uint n = 1;
+		while (n<count && pVec[n].offset == pVec[n-1].offset+pVec[n-1].count)
+			n++;
+		return n;
+	}
 };
 
 
-class cIO_DRV_SPI : public cIO_DRV
+// Fastest SPI clock asked for, the core runs at the nearest it can below it.
+// Most SPI FRAMs take 20MHz or more, the AVR cores top out at half the CPU clock.
+#ifndef SFFS_SPI_CLOCK
+#define SFFS_SPI_CLOCK 20000000UL
+#endif
+
+// SPI FRAM, ADDR_WIDTH fixes the address width when built, so the address bytes and
+// bounds checks fold away, 0 takes it from Init(). Built for widths 0, 2, 3 and 4.
+template <uint8 ADDR_WIDTH>
+class cIO_DRV_SPI_T : public cIO_DRV
 {
 public:
-	cIO_DRV_SPI() : cIO_DRV()
+	cIO_DRV_SPI_T() : cIO_DRV()
 	{
 	}
-	bool Init(uint8 csPin, uint8 addrWidth);
+	// addrWidth is ignored when ADDR_WIDTH sets it. The clock and mode are set for each
+	// transaction, so other devices on the bus can use their own. bFastRead reads with
+	// FSTRD (0x0B), for parts that need it at higher clocks.
+	bool Init(uint8 csPin, uint8 addrWidth=2, uint32 maxClock=SFFS_SPI_CLOCK, bool bFastRead=false);
 	
 	virtual uint32 Read(uint32 offset, void* pBuf, uint32 count);
 	virtual uint32 Write(uint32 offset, const void* pBuf, uint32 count);
+	virtual uint32 ReadV(const sIO_VEC* pVec, uint count);
+	virtual uint32 WriteV(const sIO_VEC* pVec, uint count);
+	virtual uint32 DeviceSize();
+protected:
+	virtual void _endWriteSession();
 private:
 	uint8 m_csPin;
 	uint8 m_addrWidth;
+	uint8 m_readCmd;
+	uint32 m_clock;
 
-	void _writeAddress(uint32 offset);
+	uint8 _addrWidth()
+	{
+		return (ADDR_WIDTH) ? ADDR_WIDTH : m_addrWidth;
+	}
+	uint8 _header(uint8* pHeader, uint8 cmd, uint32 offset);
+	void _select();
+	void _deselect();
+	void _transfer(uint8* pBuf, uint32 count);
 	void _writeEnable(bool bEnable);
 };
+typedef cIO_DRV_SPI_T<0> cIO_DRV_SPI;
 
 #define I2C_DEFAULT_ADDRESS 0x50
 
@@ -121,10 +251,72 @@ public:
 	
 	virtual uint32 Read(uint32 offset, void* pBuf, uint32 count);
 	virtual uint32 Write(uint32 offset, const void* pBuf, uint32 count);
+	virtual uint32 ReadV(const sIO_VEC* pVec, uint count);
+	virtual uint32 WriteV(const sIO_VEC* pVec, uint count);
+	virtual uint32 DeviceSize();
 private:
 	uint8 m_hwAddr;
 
 	void _writeAddress(uint32 offset);
 };
 
+#define IO_STRIPED_MAX_DEVICES 4
+// Ranges handed to a device per call
+#define IO_STRIPED_BATCH 8
+
+// Several identical FRAMs seen as one, the address space dealt out across them
+// stripeSize bytes at a time. Each device is given all of its share of a transfer
+// in one call, where its stripes follow on they go out as one bus transfer, so
+// devices on their own buses (or DMA) can work at the same time.
+class cIO_DRV_Striped : public cIO_DRV
+{
+public:
+	cIO_DRV_Striped() : cIO_DRV(),
+			m_count(0),
+			m_stripeSize(0)
+	{
+	}
+	// Devices are Init()ed by the caller, stripeSize is a power of two. Devices
+	// that can not report their size need a power of two count, to be probed,
+	// else Init() fails.
+	bool Init(cIO_DRV** pDevices, uint8 count, uint32 stripeSize=256);
+
+	virtual uint32 Read(uint32 offset, void* pBuf, uint32 count);
+	virtual uint32 Write(uint32 offset, const void* pBuf, uint32 count);
+	virtual uint32 ReadV(const sIO_VEC* pVec, uint count);
+	virtual uint32 WriteV(const sIO_VEC* pVec, uint count);
+	// The smallest device size times the device count
+	virtual uint32 DeviceSize();
+#if SFFS_STATS
+	virtual void AddBusStats(sIO_STATS* pStats)
+	{
+		for (uint8 i=0; i<m_count; i++)
+			m_pDevices[i]->AddBusStats(pStats);
+	}
+	virtual void ResetBusStats()
+	{
+		for (uint8 i=0; i<m_count; i++)
+			m_pDevices[i]->ResetBusStats();
+	}
+#endif
+
+	uint8 Count()
+	{
+		return m_count;
+	}
+	cIO_DRV* Device(uint8 index)
+	{
+		return (index<m_count) ? m_pDevices[index] : NULL;
+	}
+protected:
+	virtual void _beginWriteSession();
+	virtual void _endWriteSession();
+private:
+	cIO_DRV* m_pDevices[IO_STRIPED_MAX_DEVICES];
+	uint8 m_count;
+	uint32 m_stripeSize;
+
+	uint32 _transferV(const sIO_VEC* pVec, uint count, bool bWrite);
+};
+
 #endif //_io_driver_h
\ No newline at end of file
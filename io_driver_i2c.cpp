@@ -16,12 +16,32 @@
 
 #define DEV_DBG
 
-// This is the maximum number of bytes that can be received in one go (UNO)
-#define MULTIBYTE_BLOCK_RX_LEN 32
-// This is the maximum number of bytes that can be sent in one go (UNO)
-#define MULTIBYTE_BLOCK_TX_LEN 30
+// Size of the core's Wire buffer, which limits each request and transmission.
+// 32 bytes on AVR, larger on ESP32 (I2C_BUFFER_LENGTH), SAMD (SERIAL_BUFFER_SIZE),
+// ESP8266 and Teensy (BUFFER_LENGTH). Define SFFS_I2C_BUFFER_LENGTH to set it.
+#ifndef SFFS_I2C_BUFFER_LENGTH
+#if defined(I2C_BUFFER_LENGTH)
+#define SFFS_I2C_BUFFER_LENGTH I2C_BUFFER_LENGTH
+#elif defined(BUFFER_LENGTH)
+#define SFFS_I2C_BUFFER_LENGTH BUFFER_LENGTH
+#elif defined(SERIAL_BUFFER_SIZE)
+#define SFFS_I2C_BUFFER_LENGTH SERIAL_BUFFER_SIZE
+#else
+#define SFFS_I2C_BUFFER_LENGTH 32
+#endif
+#endif
+// This is the maximum number of bytes that can be received in one go, requestFrom() takes a uint8
+#define MULTIBYTE_BLOCK_RX_LEN ((SFFS_I2C_BUFFER_LENGTH > 255) ? 255 : SFFS_I2C_BUFFER_LENGTH)
+// This is the maximum number of bytes that can be sent in one go, after the 2 address bytes
+#define MULTIBYTE_BLOCK_TX_LEN (SFFS_I2C_BUFFER_LENGTH-2)
+// Blocks never cross into the other page, as the page bit is part of the device address
+#define I2C_PAGE_SIZE 0x10000UL
 // Page select bit (A16), MSB of 17 bit address
 #define I2C_PAGE_BIT 0x01 
+// Reserved slave address (0xF8) for reading a device ID
+#define I2C_DEVICE_ID_ADDRESS 0x7C
+// Fujitsu manufacturer code in the device ID
+#define I2C_ID_FUJITSU 0x00A
 
 
 bool
@@ -30,6 +50,28 @@ cIO_DRV_I2C::Init(uint8 hwAddr)
 	m_hwAddr = hwAddr;
 	Wire.begin();
 	return true;
+}
+
+uint32
+cIO_DRV_I2C::DeviceSize()
+{
+	uint8 id[3];
+	
+	// MB85RC parts return 12bit manufacturer, 4bit density and 8bit product codes
+	Wire.beginTransmission(I2C_DEVICE_ID_ADDRESS);
+	Wire.write((uint8)(m_hwAddr<<1));
+	IO_STAT(transactions, 2);
+	if (Wire.endTransmission(false) != 0)
+		return 0;
+	if (Wire.requestFrom((uint8)I2C_DEVICE_ID_ADDRESS, (uint8)sizeof(id)) != sizeof(id))
+		return 0;
+	for (uint i=0; i<sizeof(id); i++)
+		id[i] = Wire.read();
+	if ((((uint16)id[0]<<4) | (id[1]>>4)) != I2C_ID_FUJITSU || (id[1] & 0x0F)==0)
+		return 0;
+	// 256Kbit=5, at most 1Mbit (17bit) can be addressed
+	uint32 size = 1024UL << (id[1] & 0x0F);
+	return (size <= 0x20000) ? size : 0;
 }
 
 void
@@ -43,24 +85,68 @@ cIO_DRV_I2C::_writeAddress(uint32 offset)
 uint32
 cIO_DRV_I2C::Read(uint32 offset, void* pBuf, uint32 byteCount)
 {
+	sIO_VEC vec = { offset, pBuf, byteCount };
+	return ReadV(&vec, 1);
+}
+
+uint32
+cIO_DRV_I2C::Write(uint32 offset, const void* pBuf, uint32 byteCount)
+{
+	sIO_VEC vec = { offset, (void*)pBuf, byteCount };
+	return WriteV(&vec, 1);
+}
+
+uint32
+cIO_DRV_I2C::ReadV(const sIO_VEC* pVec, uint count)
+{
+	uint32 byteCount = 0;
 	uint32 hasRead = 0;
-	uint32 toRead = byteCount;
 
-	// Read in <= 32 byte blocks
-	while (toRead > 0)
+	for (uint i=0; i<count; )
 	{
-		uint32 addr = offset+hasRead;
-		uint8 pageBit = (addr & 0x10000) ? I2C_PAGE_BIT : 0;
-		uint8 block = (toRead > MULTIBYTE_BLOCK_RX_LEN) ? MULTIBYTE_BLOCK_RX_LEN : toRead;
-		Wire.beginTransmission(m_hwAddr | pageBit);
-		_writeAddress(addr);
-		Wire.endTransmission();
-		Wire.requestFrom(m_hwAddr, block);
-		while (Wire.available())
+		// Ranges that follow on from each other are read as one, in Wire buffer sized blocks
+		uint run = _contiguous(&pVec[i], count-i);
+		uint32 runStart = pVec[i].offset, runLen = 0, runRead = 0, segRead = 0;
+		for (uint j=0; j<run; j++)
+			runLen += pVec[i+j].count;
+		byteCount += runLen;
+		while (runRead < runLen)
 		{
-			((uint8*)pBuf)[hasRead++] = Wire.read();
-			toRead--;
+			// From the start of the run, 'i' moves on through its ranges
+			uint32 addr = runStart+runRead;
+			uint8 pageBit = (addr & 0x10000) ? I2C_PAGE_BIT : 0;
+			uint32 block = I2C_PAGE_SIZE - (addr % I2C_PAGE_SIZE);
+			if (block > MULTIBYTE_BLOCK_RX_LEN)
+				block = MULTIBYTE_BLOCK_RX_LEN;
+			if (block > runLen-runRead)
+				block = runLen-runRead;
+			// The FRAM's address counter carries on from the last block read, so the
+			// address is only sent to start a run, or a new page
+			if (runRead==0 || (addr % I2C_PAGE_SIZE)==0)
+			{
+				Wire.beginTransmission(m_hwAddr | pageBit);
+				_writeAddress(addr);
+				Wire.endTransmission(false);
+				IO_STAT(transactions, 1);
+			}
+			IO_STAT(transactions, 1);
+			if (Wire.requestFrom((uint8)(m_hwAddr | pageBit), (uint8)block)==0)
+				break;
+			while (Wire.available())
+			{
+				while (segRead==pVec[i].count)
+				{
+					i++;
+					run--;
+					segRead = 0;
+				}
+				((uint8*)pVec[i].pBuf)[segRead++] = Wire.read();
+				runRead++;
+			}
 		}
+		hasRead += runRead;
+		IO_STAT(bytesRead, runRead);
+		i += run;
 	}
 #ifdef DEV_DBG
 	if (hasRead != byteCount)
@@ -76,22 +162,56 @@ cIO_DRV_I2C::Read(uint32 offset, void* pBuf, uint32 byteCount)
 }
 
 uint32
-cIO_DRV_I2C::Write(uint32 offset, const void* pBuf, uint32 byteCount)
+cIO_DRV_I2C::WriteV(const sIO_VEC* pVec, uint count)
 {
+	uint32 byteCount = 0;
 	uint32 hasWritten = 0;
-	uint32 toWrite = byteCount;
 
-	while (toWrite > 0)
+	for (uint i=0; i<count; )
 	{
-		uint32 addr = offset+hasWritten;
-		uint8 pageBit = (addr & 0x10000) ? I2C_PAGE_BIT : 0;
-		Wire.beginTransmission(m_hwAddr | pageBit);
-		_writeAddress(addr);
-		uint8 block = (toWrite > MULTIBYTE_BLOCK_TX_LEN) ? MULTIBYTE_BLOCK_TX_LEN : toWrite;
-		uint8 done = Wire.write(&((uint8*)pBuf)[hasWritten], block);
-		toWrite -= done;
-		hasWritten += done;
-		Wire.endTransmission();
+		// Ranges that follow on from each other are written as one, in Wire buffer sized
+		// blocks. Every write has to carry its address, so only the block size helps here.
+		uint run = _contiguous(&pVec[i], count-i);
+		uint32 runStart = pVec[i].offset, runLen = 0, runWritten = 0, segWritten = 0;
+		for (uint j=0; j<run; j++)
+			runLen += pVec[i+j].count;
+		byteCount += runLen;
+		while (runWritten < runLen)
+		{
+			// From the start of the run, 'i' moves on through its ranges
+			uint32 addr = runStart+runWritten;
+			uint8 pageBit = (addr & 0x10000) ? I2C_PAGE_BIT : 0;
+			uint32 block = I2C_PAGE_SIZE - (addr % I2C_PAGE_SIZE);
+			if (block > MULTIBYTE_BLOCK_TX_LEN)
+				block = MULTIBYTE_BLOCK_TX_LEN;
+			if (block > runLen-runWritten)
+				block = runLen-runWritten;
+			Wire.beginTransmission(m_hwAddr | pageBit);
+			_writeAddress(addr);
+			while (block > 0)
+			{
+				while (segWritten==pVec[i].count)
+				{
+					i++;
+					run--;
+					segWritten = 0;
+				}
+				uint32 part = (pVec[i].count-segWritten < block) ? pVec[i].count-segWritten : block;
+				uint32 done = Wire.write(&((const uint8*)pVec[i].pBuf)[segWritten], part);
+				segWritten += done;
+				runWritten += done;
+				block -= done;
+				if (done != part)
+					break;
+			}
+			Wire.endTransmission();
+			IO_STAT(transactions, 1);
+			if (block > 0)
+				break;
+		}
+		hasWritten += runWritten;
+		IO_STAT(bytesWritten, runWritten);
+		i += run;
 	}
 #ifdef DEV_DBG
 	if (hasWritten != byteCount)
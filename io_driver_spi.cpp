@@ -17,20 +17,38 @@
 //#define DEV_DBG
 
 #define SPI_CMD_READ   0x03  // Read
+#define SPI_CMD_FSTRD  0x0B  // Fast read, a dummy byte follows the address
 #define SPI_CMD_WRITE  0x02  // Write
 #define SPI_CMD_WREN   0x06  // Write Enable
 #define SPI_CMD_WRDI   0x04  // Reset write enable
+#define SPI_CMD_RDID   0x9F  // Read device ID
 
+// Cores that support SPI transactions also have the buffer SPI.transfer(buf, count),
+// define SFFS_SPI_BYTE_TRANSFERS to force the byte at a time fallback.
+#if defined(SPI_HAS_TRANSACTION) && !defined(SFFS_SPI_BYTE_TRANSFERS)
+#define SPI_BULK_TRANSFER
+#endif
+// Stack buffer used to send write data, the bulk transfer overwrites what it sends
+#define SPI_TX_BLOCK_LEN 32
+// Largest single bulk transfer, size_t is 16bit on AVR
+#define SPI_MAX_TRANSFER 0x8000
 
+
+template <uint8 ADDR_WIDTH>
 bool
-cIO_DRV_SPI::Init(uint8 csPin, uint8 addrWidth)
+cIO_DRV_SPI_T<ADDR_WIDTH>::Init(uint8 csPin, uint8 addrWidth, uint32 maxClock, bool bFastRead)
 {
 	m_csPin = csPin;
-	m_addrWidth = addrWidth;
+	m_addrWidth = (ADDR_WIDTH) ? ADDR_WIDTH : addrWidth;
+	m_readCmd = (bFastRead) ? SPI_CMD_FSTRD : SPI_CMD_READ;
+	m_clock = maxClock;
 
 	pinMode(m_csPin, OUTPUT);
 	digitalWrite(m_csPin, HIGH);
 
+	SPI.begin();
+#ifndef SPI_HAS_TRANSACTION
+	// Older cores set the bus up once, for every device on it
 	uint8 div = SPI_CLOCK_DIV2;	// 8mhz on AVR
 	#if defined(__SAM3X8E__)
     div = 9; // 9.3 MHz
@@ -40,56 +58,210 @@ cIO_DRV_SPI::Init(uint8 csPin, uint8 addrWidth)
 	// to cover SPI1
 	div = SPI_CLOCK_DIV4; // Adafruit WICED/Particle Photon SPI @ 15MHz
 	#endif
-
-	SPI.begin();
 	SPI.setClockDivider(div);
 	SPI.setDataMode(SPI_MODE0);
+#endif
 
 	return true;
 }
 
+// The bus is taken for each CS assertion, with this FRAM's clock and mode
+template <uint8 ADDR_WIDTH>
 void
-cIO_DRV_SPI::_writeAddress(uint32 offset)
+cIO_DRV_SPI_T<ADDR_WIDTH>::_select()
 {
-	if (m_addrWidth>3)
-		SPI.transfer((uint8)(offset>>24));
-	if (m_addrWidth>2)
-		SPI.transfer((uint8)(offset>>16));
-	SPI.transfer((uint8)(offset>>8));
-	SPI.transfer((uint8)offset);
+#ifdef SPI_HAS_TRANSACTION
+	SPI.beginTransaction(SPISettings(m_clock, MSBFIRST, SPI_MODE0));
+#endif
+	digitalWrite(m_csPin, LOW);
 }
 
-void 
-cIO_DRV_SPI::_writeEnable(bool bEnable)
+template <uint8 ADDR_WIDTH>
+void
+cIO_DRV_SPI_T<ADDR_WIDTH>::_deselect()
 {
-	digitalWrite(m_csPin, LOW);
-	SPI.transfer((bEnable) ? SPI_CMD_WREN : SPI_CMD_WRDI);
 	digitalWrite(m_csPin, HIGH);
+#ifdef SPI_HAS_TRANSACTION
+	SPI.endTransaction();
+#endif
+}
+
+template <uint8 ADDR_WIDTH>
+uint8
+cIO_DRV_SPI_T<ADDR_WIDTH>::_header(uint8* pHeader, uint8 cmd, uint32 offset)
+{
+	uint8 len = 0;
+	pHeader[len++] = cmd;
+	if (_addrWidth()>3)
+		pHeader[len++] = (uint8)(offset>>24);
+	if (_addrWidth()>2)
+		pHeader[len++] = (uint8)(offset>>16);
+	pHeader[len++] = (uint8)(offset>>8);
+	pHeader[len++] = (uint8)offset;
+	return len;
 }
 
+template <uint8 ADDR_WIDTH>
+void
+cIO_DRV_SPI_T<ADDR_WIDTH>::_transfer(uint8* pBuf, uint32 count)
+{
+#ifdef SPI_BULK_TRANSFER
+	while (count > 0)
+	{
+		uint32 block = (count > SPI_MAX_TRANSFER) ? SPI_MAX_TRANSFER : count;
+		SPI.transfer(pBuf, block);
+		pBuf += block;
+		count -= block;
+	}
+#else
+	for (uint32 i=0; i<count; i++)
+		pBuf[i] = SPI.transfer(pBuf[i]);
+#endif
+}
+
+template <uint8 ADDR_WIDTH>
+void
+cIO_DRV_SPI_T<ADDR_WIDTH>::_writeEnable(bool bEnable)
+{
+	_select();
+	SPI.transfer((bEnable) ? SPI_CMD_WREN : SPI_CMD_WRDI);
+	_deselect();
+	IO_STAT(transactions, 1);
+	IO_STAT(writeEnables, (bEnable) ? 1 : 0);
+}
+
+template <uint8 ADDR_WIDTH>
 uint32
-cIO_DRV_SPI::Read(uint32 offset, void* pBuf, uint32 byteCount)
+cIO_DRV_SPI_T<ADDR_WIDTH>::Read(uint32 offset, void* pBuf, uint32 byteCount)
 {
-	digitalWrite(m_csPin, LOW);
-	SPI.transfer(SPI_CMD_READ);
-  	_writeAddress(offset);
-  	for (uint32 i=0; i<byteCount; i++)
-		((uint8*)pBuf)[i] = SPI.transfer(0);
-  	digitalWrite(m_csPin, HIGH);
-	return byteCount;
+	sIO_VEC vec = { offset, pBuf, byteCount };
+	return ReadV(&vec, 1);
 }
 
+template <uint8 ADDR_WIDTH>
 uint32
-cIO_DRV_SPI::Write(uint32 offset, const void* pBuf, uint32 byteCount)
+cIO_DRV_SPI_T<ADDR_WIDTH>::Write(uint32 offset, const void* pBuf, uint32 byteCount)
 {
-	_writeEnable(true);
-	digitalWrite(m_csPin, LOW);
-	SPI.transfer(SPI_CMD_WRITE);
-  	_writeAddress(offset);
-	for (uint32 i=0; i<byteCount; i++)
-		SPI.transfer(((uint8*)pBuf)[i]);
-	digitalWrite(m_csPin, HIGH);
-	_writeEnable(false);
+	sIO_VEC vec = { offset, (void*)pBuf, byteCount };
+	return WriteV(&vec, 1);
+}
+
+template <uint8 ADDR_WIDTH>
+uint32
+cIO_DRV_SPI_T<ADDR_WIDTH>::ReadV(const sIO_VEC* pVec, uint count)
+{
+	uint8 header[6];
+	uint32 done = 0;
+
+	for (uint i=0; i<count; )
+	{
+		// Ranges that follow on from each other share one READ command
+		uint run = _contiguous(&pVec[i], count-i);
+		uint8 len = _header(header, m_readCmd, pVec[i].offset);
+		if (m_readCmd==SPI_CMD_FSTRD)
+			header[len++] = 0;
+		_select();
+		_transfer(header, len);
+		for (; run>0; run--, i++)
+		{
+			// Data is clocked in over the top of the buffer, what it sends is ignored
+			_transfer((uint8*)pVec[i].pBuf, pVec[i].count);
+			done += pVec[i].count;
+			IO_STAT(bytesRead, pVec[i].count);
+		}
+		_deselect();
+		IO_STAT(transactions, 1);
+	}
+	return done;
+}
+
+template <uint8 ADDR_WIDTH>
+uint32
+cIO_DRV_SPI_T<ADDR_WIDTH>::WriteV(const sIO_VEC* pVec, uint count)
+{
+	uint8 block[SPI_TX_BLOCK_LEN];
+	uint32 done = 0;
+
+	for (uint i=0; i<count; )
+	{
+		// Ranges that follow on from each other share one WRITE command
+		uint run = _contiguous(&pVec[i], count-i);
+		_writeEnable(true);
+		_select();
+		// The command and address go out in the same transfer as the first data bytes,
+		// and the data is gathered into the block, which is sent each time it fills
+		uint32 len = _header(block, SPI_CMD_WRITE, pVec[i].offset);
+		for (; run>0; run--, i++)
+		{
+			for (uint32 segDone=0; segDone < pVec[i].count; )
+			{
+				uint32 part = sizeof(block)-len;
+				if (part > pVec[i].count-segDone)
+					part = pVec[i].count-segDone;
+				memcpy(&block[len], &((const uint8*)pVec[i].pBuf)[segDone], part);
+				len += part;
+				segDone += part;
+				if (len==sizeof(block))
+				{
+					_transfer(block, len);
+					len = 0;
+				}
+			}
+			done += pVec[i].count;
+			IO_STAT(bytesWritten, pVec[i].count);
+		}
+		if (len > 0)
+			_transfer(block, len);
+		_deselect();
+		IO_STAT(transactions, 1);
+	}
+	// The FRAM clears its write enable latch at the end of every WRITE, so WREN
+	// is needed each time, but inside a session the WRDI is sent once at the end.
+	if (count > 0 && !InWriteSession())
+		_writeEnable(false);
 	
-	return byteCount;
+	return done;
 }
+
+template <uint8 ADDR_WIDTH>
+uint32
+cIO_DRV_SPI_T<ADDR_WIDTH>::DeviceSize()
+{
+	uint8 id[9];
+	uint32 size = 0;
+
+	memset(id, 0, sizeof(id));
+	_select();
+	SPI.transfer(SPI_CMD_RDID);
+	_transfer(id, sizeof(id));
+	_deselect();
+	IO_STAT(transactions, 1);
+
+	if (id[0]==0x04 && id[1]==0x7F)
+	{
+		// Fujitsu MB85RS, density in the low 5 bits of the first product ID byte, 2KB=1
+		size = 1024UL << (id[2] & 0x1F);
+	}
+	else if (id[0]==0x7F && id[5]==0x7F && id[6]==0xC2)
+	{
+		// Cypress FM25V, six continuation codes then the density in the low 5 bits, 16KB=1
+		size = 8192UL << (id[7] & 0x1F);
+	}
+	// Anything that can not be addressed is a bad ID
+	if (_addrWidth()<4 && size > (1UL << (8*_addrWidth())))
+		size = 0;
+	return size;
+}
+
+template <uint8 ADDR_WIDTH>
+void
+cIO_DRV_SPI_T<ADDR_WIDTH>::_endWriteSession()
+{
+	_writeEnable(false);
+}
+
+// The widths that can be used, 0 for one given to Init()
+template class cIO_DRV_SPI_T<0>;
+template class cIO_DRV_SPI_T<2>;
+template class cIO_DRV_SPI_T<3>;
+template class cIO_DRV_SPI_T<4>;
@@ -0,0 +1,152 @@
+/**************************************************************************/
+/*!
+    @file     io_driver_striped.cpp
+    @author   Paul Holmes
+    @license  BSD (see LICENSE)
+
+    Simple FRam File System
+
+    Striped driver, one address space over several FRAM devices.
+*/
+/**************************************************************************/
+#include "io_driver.h"
+
+
+bool
+cIO_DRV_Striped::Init(cIO_DRV** pDevices, uint8 count, uint32 stripeSize)
+{
+	// A power of two stripe divides the device size, so no stripe runs off the end of one
+	if (count==0 || count>IO_STRIPED_MAX_DEVICES || stripeSize==0 || (stripeSize & (stripeSize-1))!=0)
+		return false;
+	for (uint8 i=0; i<count; i++)
+	{
+		if (pDevices[i]==NULL)
+			return false;
+		m_pDevices[i] = pDevices[i];
+	}
+	m_count = count;
+	m_stripeSize = stripeSize;
+	// Without device sizes the volume probes powers of two, which only finds them all
+	// when the count is one too
+	if ((count & (count-1))!=0 && DeviceSize()==0)
+	{
+		m_count = 0;
+		return false;
+	}
+	return true;
+}
+
+uint32
+cIO_DRV_Striped::Read(uint32 offset, void* pBuf, uint32 byteCount)
+{
+	sIO_VEC vec = { offset, pBuf, byteCount };
+	return _transferV(&vec, 1, false);
+}
+
+uint32
+cIO_DRV_Striped::Write(uint32 offset, const void* pBuf, uint32 byteCount)
+{
+	sIO_VEC vec = { offset, (void*)pBuf, byteCount };
+	return _transferV(&vec, 1, true);
+}
+
+uint32
+cIO_DRV_Striped::ReadV(const sIO_VEC* pVec, uint count)
+{
+	return _transferV(pVec, count, false);
+}
+
+uint32
+cIO_DRV_Striped::WriteV(const sIO_VEC* pVec, uint count)
+{
+	return _transferV(pVec, count, true);
+}
+
+uint32
+cIO_DRV_Striped::DeviceSize()
+{
+	uint32 size = 0;
+
+	for (uint8 i=0; i<m_count; i++)
+	{
+		uint32 devSize = m_pDevices[i]->DeviceSize();
+		if (devSize==0)
+			return 0;
+		if (i==0 || devSize<size)
+			size = devSize;
+	}
+	return size*m_count;
+}
+
+void
+cIO_DRV_Striped::_beginWriteSession()
+{
+	for (uint8 i=0; i<m_count; i++)
+		m_pDevices[i]->BeginWrite();
+}
+
+void
+cIO_DRV_Striped::_endWriteSession()
+{
+	for (uint8 i=0; i<m_count; i++)
+		m_pDevices[i]->EndWrite();
+}
+
+uint32
+cIO_DRV_Striped::_transferV(const sIO_VEC* pVec, uint count, bool bWrite)
+{
+	sIO_VEC vec[IO_STRIPED_BATCH];
+	uint32 done = 0;
+
+	if (m_count==0)
+		return 0;
+	if (bWrite)
+		BeginWrite();
+	// One pass over the ranges per device, collecting the pieces that fall on it,
+	// which keeps the stack to one batch however many devices there are
+	for (uint8 dev=0; dev<m_count; dev++)
+	{
+		uint n = 0;
+		for (uint i=0; i<count; i++)
+		{
+			uint32 offset = pVec[i].offset;
+			uint8* pBuf = (uint8*)pVec[i].pBuf;
+			uint32 left = pVec[i].count;
+			while (left > 0)
+			{
+				uint32 stripe = offset/m_stripeSize;
+				uint32 part = m_stripeSize-(offset & (m_stripeSize-1));
+				if (part > left)
+					part = left;
+				if ((stripe % m_count)==dev)
+				{
+					uint32 devOffset = ((stripe/m_count)*m_stripeSize) + (offset & (m_stripeSize-1));
+					if (n>0 && vec[n-1].offset+vec[n-1].count==devOffset && (uint8*)vec[n-1].pBuf+vec[n-1].count==pBuf)
+					{
+						vec[n-1].count += part;
+					}
+					else
+					{
+						if (n==IO_STRIPED_BATCH)
+						{
+							done += (bWrite) ? m_pDevices[dev]->WriteV(vec, n) : m_pDevices[dev]->ReadV(vec, n);
+							n = 0;
+						}
+						vec[n].offset = devOffset;
+						vec[n].pBuf = pBuf;
+						vec[n].count = part;
+						n++;
+					}
+				}
+				offset += part;
+				pBuf += part;
+				left -= part;
+			}
+		}
+		if (n>0)
+			done += (bWrite) ? m_pDevices[dev]->WriteV(vec, n) : m_pDevices[dev]->ReadV(vec, n);
+	}
+	if (bWrite)
+		EndWrite();
+	return done;
+}